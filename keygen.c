@@ -9,21 +9,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <getopt.h>
+#include "otp_codec.h"
 
 int main(int argc, char **argv) {
 	srand(time(0));
 
+	static struct option longOptions[] = {
+		{ "alphabet", required_argument, NULL, 'a' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const struct OtpAlphabet* alphabet = OtpCodecFindAlphabet(OTP_DEFAULT_ALPHABET);
+	int option;
+	while ((option = getopt_long(argc, argv, "a:", longOptions, NULL)) != -1) {
+		switch (option) {
+		case 'a':
+			alphabet = OtpCodecFindAlphabet(optarg);
+			if (alphabet == NULL) { fprintf(stderr, "unknown alphabet %s\n", optarg); exit(1); }
+			break;
+		default:
+			exit(1);
+		}
+	}
+
 	//test the number of characters enter into arg[1] for vaildity
-	if (atoi(argv[1]) <= 0) {
+	if (optind >= argc || atoi(argv[optind]) <= 0) {
 		perror("Please enter a valid number of characters");
 		exit(1);
 	}
 
-	//generate random character A-Z for each number
-	for (int i = 0; i < atoi(argv[1]); i++) {
-		int c = (rand() % (26 - 0 + 1)) + 0;
-		c += 64;
-		printf("%c", c);
+	//generate a random key character for each number
+	int keyLength = atoi(argv[optind]);
+	for (int i = 0; i < keyLength; i++) {
+		int c = rand() % alphabet->modulus;
+		printf("%c", alphabet->cipherSymbols[c]);
 	}
 	printf("%c", '\n');
 }
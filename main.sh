@@ -5,11 +5,15 @@
 echo Compiling One Time Pad program
 echo
 
-gcc -g -std=gnu99 otp_enc.c -o otp_enc
-gcc -g -std=gnu99 otp_enc_d.c -o otp_enc_d
-gcc -g -std=gnu99 otp_dec.c -o otp_dec
-gcc -g -std=gnu99 otp_dec_d.c -o otp_dec_d
-gcc -g -std=gnu99 keygen.c -o keygen
+gcc -g -std=gnu99 -c otp.c otp_codec.c
+ar rcs libotp.a otp.o otp_codec.o
+gcc -g -std=gnu99 otp_enc.c otp_client.c otp_container.c otp_net.c otp_trace.c -o otp_enc libotp.a -lpthread
+gcc -g -std=gnu99 otp_enc_d.c otp_server.c otp_net.c otp_trace.c otp_parallel.c otp_pool.c otp_tenant.c otp_store.c -o otp_enc_d libotp.a -lpthread
+gcc -g -std=gnu99 otp_dec.c otp_client.c otp_container.c otp_net.c otp_trace.c -o otp_dec libotp.a -lpthread
+gcc -g -std=gnu99 otp_dec_d.c otp_server.c otp_net.c otp_trace.c otp_parallel.c otp_pool.c otp_tenant.c otp_store.c -o otp_dec_d libotp.a -lpthread
+gcc -g -std=gnu99 keygen.c -o keygen libotp.a -lpthread
+gcc -g -std=gnu99 otp_lb.c otp_net.c -o otp_lb
+gcc -g -std=gnu99 otp_key_d.c otp_net.c -o otp_key_d libotp.a -lpthread
 chmod +wrx p4gradingscript
 
 echo Done compiling.
@@ -0,0 +1,85 @@
+/*********************************************************************
+** Program: otp.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Public interface of libotp, the one-time pad codec the
+**		daemons use, for programs that want to encrypt and decrypt
+**		in-process on their own buffers
+*********************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "otp.h"
+#include "otp_codec.h"
+
+/*********************************************************************
+** Description: Returns the alphabet with the given name, the default
+**		alphabet for NULL, or NULL if there isn't one
+*********************************************************************/
+const struct OtpAlphabet* OtpFindAlphabet(const char* name) {
+	return OtpCodecFindAlphabet(name != NULL ? name : OTP_DEFAULT_ALPHABET);
+}
+
+/*********************************************************************
+** Description: Returns 1 if every character of key is a key symbol; a
+**		newline is refused, since it would leave its text unshifted
+*********************************************************************/
+static int ValidKey(const struct OtpAlphabet* alphabet, const char* key, size_t length) {
+	return OtpCodecValidCipherText(alphabet, key, length) == 1 && memchr(key, '\n', length) == NULL;
+}
+
+/*********************************************************************
+** Description: Encrypts length characters of plainText with the same
+**		number of key characters into cipherText, which may be
+**		plainText itself; newlines in the text pass through unchanged
+*********************************************************************/
+int OtpEncrypt(const struct OtpAlphabet* alphabet, const char* plainText, const char* key, size_t length, char* cipherText) {
+	if (alphabet == NULL) return OTP_ERR_ALPHABET;
+	if (OtpCodecValidPlainText(alphabet, plainText, length) != 1) return OTP_ERR_TEXT;
+	if (ValidKey(alphabet, key, length) != 1) return OTP_ERR_KEY;
+	if (cipherText != plainText) memcpy(cipherText, plainText, length);
+	OtpCodecEncryptText(alphabet, cipherText, key, 0, length);
+	return OTP_OK;
+}
+
+/*********************************************************************
+** Description: Decrypts length characters of cipherText with the same
+**		number of key characters into plainText, which may be
+**		cipherText itself; newlines in the text pass through unchanged
+*********************************************************************/
+int OtpDecrypt(const struct OtpAlphabet* alphabet, const char* cipherText, const char* key, size_t length, char* plainText) {
+	if (alphabet == NULL) return OTP_ERR_ALPHABET;
+	if (OtpCodecValidCipherText(alphabet, cipherText, length) != 1) return OTP_ERR_TEXT;
+	if (ValidKey(alphabet, key, length) != 1) return OTP_ERR_KEY;
+	if (plainText != cipherText) memcpy(plainText, cipherText, length);
+	OtpCodecDecryptText(alphabet, plainText, key, 0, length);
+	return OTP_OK;
+}
+
+/*********************************************************************
+** Description: Returns 1 if every character of text is a plaintext
+**		symbol or a newline
+*********************************************************************/
+int OtpValidPlainText(const struct OtpAlphabet* alphabet, const char* text, size_t length) {
+	return OtpCodecValidPlainText(alphabet, text, length);
+}
+
+/*********************************************************************
+** Description: Returns 1 if every character of text is a ciphertext
+**		or key symbol or a newline
+*********************************************************************/
+int OtpValidCipherText(const struct OtpAlphabet* alphabet, const char* text, size_t length) {
+	return OtpCodecValidCipherText(alphabet, text, length);
+}
+
+/*********************************************************************
+** Description: Describes a result from one of the functions above
+*********************************************************************/
+const char* OtpError(int result) {
+	switch (result) {
+	case OTP_OK: return "success";
+	case OTP_ERR_ALPHABET: return "unknown alphabet";
+	case OTP_ERR_TEXT: return "invalid characters in text";
+	case OTP_ERR_KEY: return "invalid characters in key";
+	default: return "unknown error";
+	}
+}
@@ -0,0 +1,37 @@
+/*********************************************************************
+** Program: otp.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Public interface of libotp, the one-time pad codec the
+**		daemons use, for programs that want to encrypt and decrypt
+**		in-process on their own buffers
+*********************************************************************/
+#ifndef OTP_H
+#define OTP_H
+
+#include <stddef.h>
+
+#define OTP_API_VERSION 1 // bumped whenever a declaration below changes
+
+// Results returned by the functions below
+#define OTP_OK 0
+#define OTP_ERR_ALPHABET -1 // no alphabet by that name
+#define OTP_ERR_TEXT -2 // the text has a character outside the alphabet
+#define OTP_ERR_KEY -3 // the key has a character outside the alphabet, or a newline
+
+struct OtpAlphabet; // opaque to callers; get one from OtpFindAlphabet
+
+// Every function below is thread-safe: alphabets are built once and never
+// change after, and the others only write to the caller's buffers.
+// A newline in the text is not encrypted: it passes through unchanged and
+// still uses up its key character, so lines can be kept in a text. The
+// key itself must not contain a newline.
+
+const struct OtpAlphabet* OtpFindAlphabet(const char* name);
+int OtpEncrypt(const struct OtpAlphabet* alphabet, const char* plainText, const char* key, size_t length, char* cipherText);
+int OtpDecrypt(const struct OtpAlphabet* alphabet, const char* cipherText, const char* key, size_t length, char* plainText);
+int OtpValidPlainText(const struct OtpAlphabet* alphabet, const char* text, size_t length);
+int OtpValidCipherText(const struct OtpAlphabet* alphabet, const char* text, size_t length);
+const char* OtpError(int result);
+
+#endif
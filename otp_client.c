@@ -0,0 +1,848 @@
+/*********************************************************************
+** Program: otp_client.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Reads a text file and a cipher file and requests the
+**		daemon at the port provided to transform the text, then
+**		prints the result to stdout; shared by otp_enc and otp_dec
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <poll.h>
+#include <stdint.h>
+#include "otp_client.h"
+#include "otp_net.h"
+#include "otp_trace.h"
+#include "otp_container.h"
+
+//prototypes
+int Handshake(struct ClientMode* mode, int socketFD);
+int ReqTransform(struct ClientMode* mode, int socketFD, char* text, char* key, size_t textLength);
+static void* SendStripe(void* arg);
+int ValidateFiles(struct ClientMode* mode, char* text, char* key);
+char* ReadFile(char* inFileName);
+static char* ReadContainerRange(struct ClientMode* mode, char* containerPath, char* padPath, long long start, long long length);
+char* ReadKeyWindow(char* padPath, long long offset, size_t symbols, size_t bufferSize);
+static size_t ReadKeyChunk(int padFD, long long offset, char* key, size_t symbols, int sequential);
+static void PadId(const char* padPath, char* id, size_t idSize);
+static long long NextKeyOffset(struct ClientMode* mode, FILE* ledger, const char* padId, long long offset, size_t length);
+static int ConnectLocal(char* port);
+char* FetchKey(char* port, char* savePath, size_t symbols, size_t bufferSize);
+static void ReqResult(struct ClientMode* mode, char* port);
+static void StreamText(struct ClientMode* mode, char* port, char* padPath);
+static void WaitToRetry(int attempt, int retryAfter, unsigned int* seed, char* port);
+
+#define MAX_STRIPES 64
+#define MIN_STRIPE_SIZE 65536 // smaller pieces cost more in round trips than they save
+#define MAX_BUSY_RETRIES 10 // times a busy daemon is tried again before giving up
+#define MAX_RETRY_WAIT 5000 // ms cap on the backoff between retries
+#define STREAM_CHUNK 65536 // most bytes of a stream sent in one frame
+#define FRAME_HEADER 10 // digits of the length that starts each stream frame
+
+static void error(const char *msg) { perror(msg); exit(0); } // Error function used for reporting issues
+
+// One piece of the text, sent over its own connection and transformed in place
+struct Stripe {
+	struct ClientMode* mode;
+	char* port;
+	char* text;
+	char* key;
+	size_t length;
+};
+
+static const struct OtpAlphabet* alphabet; // symbols the text and key are drawn from, see --alphabet
+static long long keyOffset = -1; // where in the pad the key starts, -1 for the ledger's next free byte or 0, see --key-offset
+static size_t keyLength; // pad bytes this message takes, 0 for just what it needs, see --key-length
+static char* ledgerPath; // file of pad ranges already used, see --key-ledger
+static char* tenantId; // who the daemon's fair share should count this request against, see --tenant
+static char* keyServer; // port of an otp_key_d to take a fresh key from, see --key-server
+static int numStripes = 1; // connections a text is split across, see --stripes
+static int submitOnly; // take a ticket instead of waiting for the result, see --submit
+static char* fetchTicket; // ticket of an earlier submit to collect, see --fetch
+static int fetchWait; // keep asking until a pending result is ready, see --wait
+static char ticket[32]; // what the daemon handed out for a submit
+static int containerOut; // write the result as a container, see --container
+static long long rangeStart, rangeLength = -1; // part of a container to decrypt, -1 for all of it, see --range
+
+/*********************************************************************
+** Description: Connects to the server port provided and requests
+**		the transformation of provided files
+*********************************************************************/
+int RunClient(struct ClientMode* mode, int argc, char *argv[]) {
+	static struct option longOptions[] = {
+		{ "alphabet", required_argument, NULL, 'a' },
+		{ "trace", required_argument, NULL, 'r' },
+		{ "key-offset", required_argument, NULL, 'o' },
+		{ "key-length", required_argument, NULL, 'l' },
+		{ "key-ledger", required_argument, NULL, 'L' },
+		{ "tenant", required_argument, NULL, 'n' },
+		{ "key-server", required_argument, NULL, 'k' },
+		{ "stripes", required_argument, NULL, 's' },
+		{ "submit", no_argument, NULL, 'S' },
+		{ "fetch", required_argument, NULL, 'f' },
+		{ "wait", no_argument, NULL, 'w' },
+		{ "container", no_argument, NULL, 'C' },
+		{ "range", required_argument, NULL, 'g' },
+		{ NULL, 0, NULL, 0 }
+	};
+	alphabet = OtpCodecFindAlphabet(OTP_DEFAULT_ALPHABET);
+	int option;
+	while ((option = getopt_long(argc, argv, "a:r:o:l:L:n:k:s:Sf:wCg:", longOptions, NULL)) != -1) {
+		switch (option) {
+		case 'a':
+			alphabet = OtpCodecFindAlphabet(optarg);
+			if (alphabet == NULL) { fprintf(stderr, "CLIENT: unknown alphabet %s\n", optarg); exit(1); }
+			break;
+		case 'r':
+			TraceOpen(optarg, mode->progName);
+			break;
+		case 'o':
+			keyOffset = strtoll(optarg, NULL, 10);
+			if (keyOffset < 0) { fprintf(stderr, "CLIENT: key offset must not be negative\n"); exit(1); }
+			break;
+		case 'l':
+			keyLength = strtoul(optarg, NULL, 10);
+			break;
+		case 'L':
+			ledgerPath = optarg;
+			break;
+		case 'n':
+			if (strlen(optarg) == 0 || strlen(optarg) >= 48 || strpbrk(optarg, " \n") != NULL) { fprintf(stderr, "CLIENT: bad tenant %s\n", optarg); exit(1); }
+			tenantId = optarg;
+			break;
+		case 'k':
+			keyServer = optarg;
+			break;
+		case 's':
+			numStripes = atoi(optarg);
+			if (numStripes < 1 || numStripes > MAX_STRIPES) { fprintf(stderr, "CLIENT: stripes must be 1 to %d\n", MAX_STRIPES); exit(1); }
+			break;
+		case 'S':
+			submitOnly = 1;
+			break;
+		case 'f':
+			fetchTicket = optarg;
+			break;
+		case 'w':
+			fetchWait = 1;
+			break;
+		case 'C':
+			containerOut = 1;
+			break;
+		case 'g':
+			if (sscanf(optarg, "%lld:%lld", &rangeStart, &rangeLength) != 2 || rangeStart < 0 || rangeLength <= 0) { fprintf(stderr, "CLIENT: bad range %s, expected start:length\n", optarg); exit(1); }
+			break;
+		default:
+			exit(1);
+		}
+	}
+	if (fetchTicket != NULL) {
+		if (argc - optind < 1) { fprintf(stderr, "CLIENT: USAGE: %s --fetch ticket [--wait] port\n", argv[0]); exit(1); }
+		ReqResult(mode, argv[optind]);
+	}
+	if (argc - optind < 3) { fprintf(stderr, "CLIENT: USAGE: %s [--alphabet name] [--trace file] [--key-offset n] [--key-length n] [--key-ledger file] [--tenant id] [--key-server port] [--stripes n] [--submit] [--container] [--range start:length] %s|- key port[,port...]\n", argv[0], mode->textArg); exit(1); } // Check usage & args
+	argv += optind - 1; // the text, key and port are argv[1] to argv[3] from here on
+	if (keyServer != NULL && !mode->keyOnce) { fprintf(stderr, "CLIENT: a fresh key from --key-server can only encrypt\n"); exit(1); }
+	if (keyServer != NULL && (keyOffset >= 0 || ledgerPath != NULL)) { fprintf(stderr, "CLIENT: a key from --key-server has no offset or ledger\n"); exit(1); }
+	if (ledgerPath != NULL && !mode->keyOnce && keyOffset < 0) { fprintf(stderr, "CLIENT: decryption needs the --key-offset the sender used; the ledger only hands out unused ranges\n"); exit(1); }
+	if (submitOnly && numStripes > 1) { fprintf(stderr, "CLIENT: a submitted job has one ticket, so it cannot be striped\n"); exit(1); }
+	int streaming = strcmp(argv[1], "-") == 0; // text from stdin, result to stdout as it comes
+	if (streaming && (numStripes > 1 || submitOnly || keyServer != NULL)) { fprintf(stderr, "CLIENT: a stream from stdin cannot be striped, submitted or keyed from --key-server\n"); exit(1); }
+	if (containerOut && (!mode->keyOnce || streaming || submitOnly)) { fprintf(stderr, "CLIENT: only a whole encryption can be written as a container\n"); exit(1); }
+	if (streaming && ledgerPath != NULL && keyLength == 0) { fprintf(stderr, "CLIENT: a stream needs --key-length to claim a range in the key ledger\n"); exit(1); }
+
+	char *text = NULL;
+	char *key = NULL;
+	long long phaseStart = TraceNow();
+	size_t textLength = 0, symbols = 0;
+	if (!streaming) {
+		text = ReadContainerRange(mode, argv[1], argv[2], rangeStart, rangeLength); // sets the alphabet and key offset
+		if (text == NULL) text = ReadFile(argv[1]);
+		textLength = strlen(text);
+		symbols = textLength > 0 && text[textLength - 1] == '\n' ? textLength - 1 : textLength; // the newline needs no key
+		if (keyLength == 0) keyLength = symbols;
+		if (keyLength < symbols) { fprintf(stderr, "CLIENT: key is too short for message\n"); exit(1); }
+	}
+
+	//claim the next free range of the pad, or check the one asked for, holding the ledger until it is recorded
+	FILE* ledger = NULL;
+	char padId[64];
+	if (ledgerPath != NULL) {
+		ledger = fopen(ledgerPath, "a+");
+		if (ledger == NULL) { fprintf(stderr, "CLIENT: could not open key ledger %s\n", ledgerPath); exit(1); }
+		flock(fileno(ledger), LOCK_EX);
+		PadId(argv[2], padId, sizeof(padId));
+		keyOffset = NextKeyOffset(mode, ledger, padId, keyOffset, keyLength);
+	}
+	if (keyOffset < 0) keyOffset = 0;
+	if (!streaming) {
+		if (keyServer != NULL) key = FetchKey(keyServer, argv[2], symbols, textLength);
+		else key = ReadKeyWindow(argv[2], keyOffset, symbols, textLength);
+		TraceSpan("read files", phaseStart);
+		phaseStart = TraceNow();
+		if (ValidateFiles(mode, text, key) != 1) {
+			exit(1);
+		}
+		TraceSpan("validate", phaseStart);
+	}
+
+	//the range counts as used from here on, even if the daemon never answers
+	if (ledger != NULL) {
+		fprintf(ledger, "%s %lld %zu\n", padId, keyOffset, keyLength);
+		if (fflush(ledger) != 0) { fprintf(stderr, "CLIENT: could not record key range in %s\n", ledgerPath); exit(1); }
+		fclose(ledger); // releases the lock
+		fprintf(stderr, "CLIENT: key offset %lld length %zu\n", keyOffset, keyLength);
+	}
+
+	//a comma separated list of ports spreads the stripes over several daemons
+	char* ports[MAX_STRIPES];
+	int numPorts = 0;
+	for (char* port = strtok(argv[3], ","); port != NULL && numPorts < MAX_STRIPES; port = strtok(NULL, ",")) {
+		ports[numPorts++] = port;
+	}
+	if (numPorts == 0) { fprintf(stderr, "CLIENT: no port given\n"); exit(1); }
+	if (streaming) {
+		StreamText(mode, ports[0], argv[2]);
+		exit(0);
+	}
+
+	//split the text into contiguous stripes, the last one keeping the newline
+	if (symbols / MIN_STRIPE_SIZE < numStripes) numStripes = symbols / MIN_STRIPE_SIZE > 0 ? symbols / MIN_STRIPE_SIZE : 1;
+	struct Stripe stripes[MAX_STRIPES];
+	for (int i = 0; i < numStripes; i++) {
+		size_t start = symbols * i / numStripes;
+		size_t end = i == numStripes - 1 ? textLength : symbols * (i + 1) / numStripes;
+		stripes[i] = (struct Stripe){ mode, ports[i % numPorts], text + start, key + start, end - start };
+	}
+	if (TraceEnabled()) TraceRequestId(); // made up once, before the stripes share it
+
+	//every stripe but the first gets its own thread; the first runs here
+	pthread_t threads[MAX_STRIPES];
+	for (int i = 1; i < numStripes; i++) {
+		if (pthread_create(&threads[i], NULL, SendStripe, &stripes[i]) != 0) error("CLIENT: ERROR starting stripe");
+	}
+	SendStripe(&stripes[0]);
+	for (int i = 1; i < numStripes; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	//a submit prints the ticket to fetch the result with later
+	if (submitOnly) {
+		printf("%s\n", ticket);
+		exit(0);
+	}
+
+	//print the transformed text
+	phaseStart = TraceNow();
+	if (containerOut) {
+		PadId(argv[2], padId, sizeof(padId));
+		if (WriteContainer(stdout, padId, keyOffset, alphabet->name, text, symbols) != 1) error("CLIENT: ERROR writing container");
+	}
+	else {
+		printf("%s", text);
+		fflush(stdout);
+	}
+	TraceSpan("write output", phaseStart);
+
+	exit(0);
+}
+
+/*********************************************************************
+** Description: Connects to a daemon and has it transform one stripe
+**		in place; any failure ends the whole process
+*********************************************************************/
+static void* SendStripe(void* arg) {
+	struct Stripe* stripe = arg;
+	unsigned int seed = getpid() ^ (uintptr_t)stripe; // jitter differs between clients and stripes
+
+	for (int attempt = 0; ; attempt++) {
+		//connect to server
+		long long phaseStart = TraceNow();
+		int socketFD = ConnectLocal(stripe->port);
+		TraceSpan("connect", phaseStart);
+
+		phaseStart = TraceNow();
+		if (Handshake(stripe->mode, socketFD) != 1) {
+			close(socketFD);
+			fprintf(stderr, "CLIENT: Could not connect to port %s, terminating process.", stripe->port);
+			exit(2);
+		}
+		TraceSpan("handshake", phaseStart);
+		int retryAfter = ReqTransform(stripe->mode, socketFD, stripe->text, stripe->key, stripe->length);
+		close(socketFD); // Close the socket
+		if (retryAfter == 0) return NULL;
+
+		WaitToRetry(attempt, retryAfter, &seed, stripe->port);
+	}
+}
+
+/*********************************************************************
+** Description: Sleeps before the next try at a daemon that was out of
+**		memory budget, or gives up after MAX_BUSY_RETRIES
+*********************************************************************/
+static void WaitToRetry(int attempt, int retryAfter, unsigned int* seed, char* port) {
+	//back off exponentially, with jitter so retries spread out
+	if (attempt == MAX_BUSY_RETRIES) {
+		fprintf(stderr, "CLIENT: daemon on port %s stayed busy, terminating process.\n", port);
+		exit(2);
+	}
+	long wait = (long)retryAfter << (attempt < 4 ? attempt : 4);
+	if (wait > MAX_RETRY_WAIT) wait = MAX_RETRY_WAIT;
+	poll(NULL, 0, wait / 2 + rand_r(seed) % (wait / 2 + 1));
+}
+
+/*********************************************************************
+** Description: Encrypts or decrypts stdin to stdout a frame at a time,
+**		so output starts with the first line and memory stays
+**		bounded however long the stream; each frame is a length of
+**		FRAME_HEADER digits, the text and its key, and a length of 0
+**		ends the stream. Every byte, newlines included, uses the key
+**		at its position so frames never need realigning
+*********************************************************************/
+static void StreamText(struct ClientMode* mode, char* port, char* padPath) {
+	char buffer[1024];
+	char retryValue[16];
+	unsigned int seed = getpid();
+	int padFD = open(padPath, O_RDONLY);
+	if (padFD < 0) {
+		fprintf(stderr, "CLIENT: could not open file %s\n", padPath);
+		exit(1);
+	}
+
+	//open the stream, waiting out a daemon short of memory as a whole request would
+	int socketFD;
+	long long phaseStart = TraceNow();
+	for (int attempt = 0; ; attempt++) {
+		socketFD = ConnectLocal(port);
+		if (Handshake(mode, socketFD) != 1) {
+			close(socketFD);
+			fprintf(stderr, "CLIENT: Could not connect to port %s, terminating process.", port);
+			exit(2);
+		}
+		snprintf(buffer, sizeof(buffer), "stream chunk=%d", STREAM_CHUNK);
+		if (strcmp(alphabet->name, OTP_DEFAULT_ALPHABET) != 0) sprintf(buffer + strlen(buffer), " alphabet=%s", alphabet->name);
+		if (TraceEnabled()) sprintf(buffer + strlen(buffer), " rid=%s", TraceRequestId());
+		if (SendAll(socketFD, buffer, strlen(buffer)) != 1) error("CLIENT: ERROR writing stream request to socket");
+		memset(buffer, '\0', sizeof(buffer));
+		if (recv(socketFD, buffer, sizeof(buffer) - 1, 0) < 0) error("CLIENT: ERROR reading stream reply from socket");
+		if (strcmp(buffer, mode->textReq) == 0) break;
+		close(socketFD);
+		if (strcmp(buffer, "toolarge") == 0) {
+			fprintf(stderr, "CLIENT: daemon on port %s does not accept streams of %d byte frames\n", port, STREAM_CHUNK);
+			exit(1);
+		}
+		if (strncmp(buffer, "busy", 4) != 0) {
+			fprintf(stderr, "CLIENT: server failed to request %s properly\n", mode->textName);
+			exit(1);
+		}
+		int retryAfter = GetAttribute(buffer, "retry", retryValue, sizeof(retryValue)) == 1 ? atoi(retryValue) : 0;
+		WaitToRetry(attempt, retryAfter > 0 ? retryAfter : 100, &seed, port);
+	}
+	TraceSpan("size exchange", phaseStart);
+
+	//the header, text and key go out in one send so small frames aren't held back by Nagle
+	char* frame = malloc(FRAME_HEADER + 2 * STREAM_CHUNK + 1);
+	if (frame == NULL) error("CLIENT: unable to allocate space for stream");
+	char* text = frame + FRAME_HEADER;
+	long long consumed = 0;
+	while (1) {
+		long textRead = read(STDIN_FILENO, text, STREAM_CHUNK); // whatever has arrived, up to a chunk
+		if (textRead < 0 && errno == EINTR) continue;
+		if (textRead < 0) error("CLIENT: ERROR reading stdin");
+		if (textRead == 0) break;
+		if (mode->validText(alphabet, text, textRead) != 1) {
+			fprintf(stderr, "CLIENT: invalid characters detected in %s", mode->textName);
+			exit(1);
+		}
+		char* key = text + textRead;
+		size_t keyRead = keyLength > 0 && consumed + textRead > keyLength ? 0 : ReadKeyChunk(padFD, keyOffset + consumed, key, textRead, keyOffset == 0);
+		if (keyRead < textRead) {
+			fprintf(stderr, "CLIENT: key is too short for message\n");
+			exit(1);
+		}
+		if (OtpCodecValidCipherText(alphabet, key, textRead) != 1) {
+			fprintf(stderr, "CLIENT: invalid characters detected in key");
+			exit(1);
+		}
+
+		char header[FRAME_HEADER + 1];
+		sprintf(header, "%0*ld", FRAME_HEADER, textRead);
+		memcpy(frame, header, FRAME_HEADER);
+		if (SendAll(socketFD, frame, FRAME_HEADER + 2 * textRead) != 1) error("CLIENT: ERROR writing frame to socket");
+		if (RecvAll(socketFD, text, textRead) != textRead) error("CLIENT: ERROR reading result from socket");
+		if (fwrite(text, 1, textRead, stdout) != textRead || fflush(stdout) != 0) error("CLIENT: ERROR writing stdout");
+		consumed += textRead;
+	}
+	sprintf(buffer, "%0*d", FRAME_HEADER, 0);
+	if (SendAll(socketFD, buffer, FRAME_HEADER) != 1) error("CLIENT: ERROR ending stream");
+	TraceSpan("stream", phaseStart);
+	free(frame);
+	close(socketFD);
+	close(padFD);
+}
+
+/*********************************************************************
+** Description: Collects the result of an earlier --submit and prints
+**		it; exits 3 while it is pending, unless --wait, and 1 if the
+**		daemon has no result for the ticket
+*********************************************************************/
+static void ReqResult(struct ClientMode* mode, char* port) {
+	char buffer[1024];
+	char sizeValue[32];
+
+	while (1) {
+		int socketFD = ConnectLocal(port);
+		if (Handshake(mode, socketFD) != 1) {
+			close(socketFD);
+			fprintf(stderr, "CLIENT: Could not connect to port %s, terminating process.", port);
+			exit(2);
+		}
+		snprintf(buffer, sizeof(buffer), "fetch ticket=%s%s", fetchTicket, fetchWait ? " wait=1" : "");
+		if (SendAll(socketFD, buffer, strlen(buffer)) != 1) error("CLIENT: ERROR writing fetch to socket");
+		memset(buffer, '\0', sizeof(buffer));
+		if (recv(socketFD, buffer, sizeof(buffer) - 1, 0) < 0) error("CLIENT: ERROR reading fetch reply from socket");
+
+		if (strncmp(buffer, "ready", 5) == 0 && GetAttribute(buffer, "size", sizeValue, sizeof(sizeValue)) == 1) {
+			size_t resultLength = strtoul(sizeValue, NULL, 10);
+			char* result = malloc(resultLength + 1);
+			if (result == NULL) error("CLIENT: unable to allocate space for result");
+			if (SendAll(socketFD, "sendResult", 10) != 1) error("CLIENT: ERROR writing result request to socket");
+			if (RecvAll(socketFD, result, resultLength) != resultLength) error("CLIENT: ERROR reading result from socket");
+			close(socketFD);
+			fwrite(result, 1, resultLength, stdout);
+			fflush(stdout);
+			exit(0);
+		}
+		close(socketFD);
+		if (strcmp(buffer, "pending") == 0) {
+			if (fetchWait) continue; // the daemon already held the reply a while
+			fprintf(stderr, "CLIENT: ticket %s is still pending\n", fetchTicket);
+			exit(3);
+		}
+		fprintf(stderr, "CLIENT: daemon on port %s has no result for ticket %s\n", port, fetchTicket);
+		exit(1);
+	}
+}
+
+/*********************************************************************
+** Description: Connects to port on localhost, returns the socket
+*********************************************************************/
+static int ConnectLocal(char* port) {
+	int socketFD, portNumber;
+	struct sockaddr_in serverAddress;
+	struct hostent* serverHostInfo;
+
+	// Set up the server address struct
+	memset((char*)&serverAddress, '\0', sizeof(serverAddress)); // Clear out the address struct
+	portNumber = atoi(port); // Get the port number, convert to an integer from a string
+	serverAddress.sin_family = AF_INET; // Create a network-capable socket
+	serverAddress.sin_port = htons(portNumber); // Store the port number
+	serverHostInfo = gethostbyname("localhost"); // Convert the machine name into a special form of address
+	if (serverHostInfo == NULL) { fprintf(stderr, "CLIENT: ERROR, no such host as %s\n", "localhost"); exit(0); }
+	memcpy((char*)&serverAddress.sin_addr.s_addr, (char*)serverHostInfo->h_addr, serverHostInfo->h_length); // Copy in the address
+
+	// Set up the socket
+	socketFD = socket(AF_INET, SOCK_STREAM, 0); // Create the socket
+	if (socketFD < 0) error("CLIENT: ERROR opening socket");
+
+	// Connect to server
+	if (connect(socketFD, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0) // Connect socket to address
+		error("CLIENT: ERROR connecting");
+	return socketFD;
+}
+
+/*********************************************************************
+** Description: Takes a fresh key of symbols characters from the
+**		otp_key_d at port in one round trip and saves it, with a
+**		newline, to savePath for the other side; returns it in a
+**		zeroed buffer of bufferSize characters
+*********************************************************************/
+char* FetchKey(char* port, char* savePath, size_t symbols, size_t bufferSize) {
+	//refuse before spending key material if it could not be kept
+	int saveFD = open(savePath, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (saveFD < 0) {
+		fprintf(stderr, "CLIENT: could not create key file %s, it must not exist yet\n", savePath);
+		exit(1);
+	}
+	char* key = calloc(bufferSize + 2, sizeof(char));
+	if (key == NULL) error("CLIENT: unable to allocate space for key");
+	if (symbols == 0) {
+		close(saveFD);
+		return key;
+	}
+
+	char request[128];
+	sprintf(request, "otp_key size=%zu", symbols);
+	if (strcmp(alphabet->name, OTP_DEFAULT_ALPHABET) != 0) sprintf(request + strlen(request), " alphabet=%s", alphabet->name);
+	int socketFD = ConnectLocal(port);
+	if (SendAll(socketFD, request, strlen(request)) != 1) error("CLIENT: ERROR writing key request to socket");
+
+	//the reply is a header line, then the key
+	char header[128];
+	size_t headerLength = 0;
+	while (headerLength < sizeof(header) - 1 && (headerLength == 0 || header[headerLength - 1] != '\n')) {
+		long charsRead = recv(socketFD, header + headerLength, 1, 0);
+		if (charsRead <= 0) break;
+		headerLength += charsRead;
+	}
+	header[headerLength] = '\0';
+	if (strncmp(header, "otp_key_d serial=", 17) != 0) {
+		unlink(savePath);
+		fprintf(stderr, "CLIENT: key server on port %s refused the request: %s\n", port, header);
+		exit(2);
+	}
+	if (RecvAll(socketFD, key, symbols) != symbols) {
+		unlink(savePath);
+		error("CLIENT: ERROR reading key from socket");
+	}
+	close(socketFD);
+
+	key[symbols] = '\n';
+	if (write(saveFD, key, symbols + 1) != symbols + 1 || close(saveFD) != 0) {
+		unlink(savePath);
+		error("CLIENT: ERROR saving key");
+	}
+	key[symbols] = '\0';
+	return key;
+}
+
+/*********************************************************************
+** Description: Exchanges basic string messages with the daemon
+**		to determine that it has connected to the correct program
+*********************************************************************/
+int Handshake(struct ClientMode* mode, int socketFD) {
+	char buffer[1024];
+	memset(buffer, '\0', 1024);
+	int charsRead;
+
+	// Send handshake to server, naming the tenant if there is one
+	snprintf(buffer, sizeof(buffer), "%s", mode->progName);
+	if (tenantId != NULL) snprintf(buffer, sizeof(buffer), "%s tenant=%s", mode->progName, tenantId);
+	if (SendAll(socketFD, buffer, strlen(buffer)) != 1) error("CLIENT: ERROR writing id message to socket");
+
+	// Get get return handshake from server
+	memset(buffer, '\0', sizeof(buffer)); // Clear out the buffer again for reuse
+	charsRead = recv(socketFD, buffer, sizeof(buffer) - 1, 0); // Read data from the socket, leaving \0 at end
+	if (charsRead < 0) error("CLIENT: ERROR reading from socket");
+
+	//confirm daemon identity
+	if (strcmp(buffer, mode->daemonName) == 0) {
+		return 1;
+	}
+	return 0;
+}
+
+/*********************************************************************
+** Description: Sends the daemon that the program is connected to
+**		textLength characters of text and key and then receives the
+**		transformed result in their place; returns 0, or the ms to
+**		wait before retrying when the daemon is busy
+*********************************************************************/
+int ReqTransform(struct ClientMode* mode, int socketFD, char* text, char* key, size_t textLength) {
+	char buffer[1024];
+	memset(buffer, '\0', 1024);
+	char errMsg[100];
+	char textSize[100];
+	char* keyReq = "sendKey";
+	long charsRead;
+
+	// send size of text to server, with the alphabet, request id and async flag when there are any
+	long long phaseStart = TraceNow();
+	sprintf(textSize, "%zu", textLength);
+	if (submitOnly) strcat(textSize, " async=1");
+	if (strcmp(alphabet->name, OTP_DEFAULT_ALPHABET) != 0) {
+		sprintf(textSize + strlen(textSize), " alphabet=%s", alphabet->name);
+	}
+	if (TraceEnabled()) {
+		sprintf(textSize + strlen(textSize), " rid=%s", TraceRequestId());
+	}
+	sprintf(errMsg, "CLIENT: ERROR writing %s size to socket", mode->textName);
+	if (SendAll(socketFD, textSize, strlen(textSize)) != 1) error(errMsg);
+
+	// get request for text
+	memset(buffer, '\0', sizeof(buffer)); // Clear out the buffer again for reuse
+	charsRead = recv(socketFD, buffer, sizeof(buffer) - 1, 0); // Read data from the socket, leaving \0 at end
+	sprintf(errMsg, "CLIENT: ERROR reading %s request from socket", mode->textName);
+	if (charsRead < 0) error(errMsg);
+	TraceSpan("size exchange", phaseStart);
+
+	//a daemon short of memory asks for the whole request again later
+	char retryValue[16];
+	if (strncmp(buffer, "busy", 4) == 0) {
+		int retryAfter = GetAttribute(buffer, "retry", retryValue, sizeof(retryValue)) == 1 ? atoi(retryValue) : 0;
+		return retryAfter > 0 ? retryAfter : 100;
+	}
+	if (strcmp(buffer, "toolarge") == 0) {
+		fprintf(stderr, "CLIENT: %s is larger than the daemon accepts\n", mode->textName);
+		exit(1);
+	}
+
+	if (strcmp(buffer, mode->textReq) == 0) {
+		// Send text to server
+		phaseStart = TraceNow();
+		sprintf(errMsg, "CLIENT: ERROR writing %s to socket", mode->textName);
+		if (SendAll(socketFD, text, textLength) != 1) error(errMsg);
+		TraceSpan("send text", phaseStart);
+	}
+	else {
+		sprintf(errMsg, "CLIENT: server failed to request %s properly\n", mode->textName);
+		error(errMsg);
+	}
+
+	// Get key request message from server
+	memset(buffer, '\0', sizeof(buffer)); // Clear out the buffer again for reuse
+	charsRead = recv(socketFD, buffer, sizeof(buffer) - 1, 0); // Read data from the socket, leaving \0 at end
+	if (charsRead < 0) error("CLIENT: ERROR reading key request from socket");
+
+	if (strcmp(buffer, keyReq) == 0) {
+		// Send key to server
+		phaseStart = TraceNow();
+		if (SendAll(socketFD, key, textLength) != 1) error("CLIENT: ERROR writing key to socket");
+		TraceSpan("send key", phaseStart);
+	}
+	else {
+		error("CLIENT: server failed to request key properly\n");
+	}
+
+	// A submitted job only gets a ticket back
+	if (submitOnly) {
+		memset(buffer, '\0', sizeof(buffer));
+		charsRead = recv(socketFD, buffer, sizeof(buffer) - 1, 0);
+		if (charsRead < 0) error("CLIENT: ERROR reading ticket from socket");
+		if (strncmp(buffer, "ticket=", 7) != 0 || strlen(buffer + 7) >= sizeof(ticket)) error("CLIENT: server failed to hand out a ticket");
+		strcpy(ticket, buffer + 7);
+		return 0;
+	}
+
+	// Get the transformed text from server
+	phaseStart = TraceNow();
+	charsRead = RecvAll(socketFD, text, textLength); // Read data from the socket
+	if (charsRead != textLength) {
+		//a daemon that died mid reply leaves the input in text; it must never be printed as the result
+		memset(text, '\0', textLength);
+		if (charsRead < 0) perror("CLIENT: ERROR reading result from socket");
+		else fprintf(stderr, "CLIENT: daemon sent %ld of %zu result characters, terminating process.\n", charsRead, textLength);
+		exit(1);
+	}
+	TraceSpan("receive result", phaseStart);
+	return 0;
+}
+
+/*********************************************************************
+** Description: If containerPath is a container, reads just the blocks
+**		holding length characters from start, or all of it for a
+**		length of -1, checks them and returns those characters and a
+**		newline; takes the alphabet and key offset from its header.
+**		Returns NULL for a file that is not a container
+*********************************************************************/
+static char* ReadContainerRange(struct ClientMode* mode, char* containerPath, char* padPath, long long start, long long length) {
+	struct ContainerHeader header;
+	int containerFD = open(containerPath, O_RDONLY);
+	if (containerFD < 0) {
+		fprintf(stderr, "CLIENT: could not open file %s\n", containerPath);
+		exit(1);
+	}
+	int isContainer = ReadContainerHeader(containerFD, &header);
+	if (isContainer == 0 && length < 0) {
+		close(containerFD);
+		return NULL;
+	}
+	if (isContainer != 1) { fprintf(stderr, "CLIENT: %s is not a valid container\n", containerPath); exit(1); }
+	if (mode->keyOnce) { fprintf(stderr, "CLIENT: %s is a container, which can only be decrypted\n", containerPath); exit(1); }
+	if (keyOffset >= 0 || ledgerPath != NULL || keyServer != NULL) { fprintf(stderr, "CLIENT: a container records its own key offset\n"); exit(1); }
+	if (length < 0) length = header.length;
+	if (start + length > header.length) { fprintf(stderr, "CLIENT: range ends past the %lld characters of %s\n", header.length, containerPath); exit(1); }
+
+	alphabet = OtpCodecFindAlphabet(header.alphabet);
+	if (alphabet == NULL) { fprintf(stderr, "CLIENT: %s uses unknown alphabet %s\n", containerPath, header.alphabet); exit(1); }
+	char padId[64];
+	PadId(padPath, padId, sizeof(padId));
+	if (strcmp(padId, header.padId) != 0) fprintf(stderr, "CLIENT: warning, %s is not the pad file %s was made with\n", padPath, containerPath);
+	keyOffset = header.keyOffset + start; // the key window lines up with the range
+
+	//read only the whole blocks the range touches, so their checksums can be checked
+	long long firstBlock = start / header.blockSize;
+	long long blocksStart = firstBlock * header.blockSize;
+	long long blocksEnd = (start + length + header.blockSize - 1) / header.blockSize * header.blockSize;
+	if (blocksEnd > header.length) blocksEnd = header.length;
+	size_t blocksLength = blocksEnd - blocksStart;
+	char* blocks = malloc(blocksLength + 2);
+	if (blocks == NULL) error("CLIENT: unable to allocate space for container range");
+	size_t charsTotal = 0;
+	while (charsTotal < blocksLength) {
+		long charsRead = pread(containerFD, blocks + charsTotal, blocksLength - charsTotal, header.dataOffset + blocksStart + charsTotal);
+		if (charsRead < 0 && errno == EINTR) continue;
+		if (charsRead <= 0) break;
+		charsTotal += charsRead;
+	}
+	if (charsTotal < blocksLength) { fprintf(stderr, "CLIENT: %s is truncated\n", containerPath); exit(1); }
+	long long badBlock = CheckContainerBlocks(containerFD, &header, firstBlock, blocks, blocksLength);
+	if (badBlock >= 0) { fprintf(stderr, "CLIENT: block %lld of %s fails its checksum\n", badBlock, containerPath); exit(1); }
+	close(containerFD);
+
+	//the range moves to the front of the buffer and ends in a newline, as a cipher file would
+	memmove(blocks, blocks + (start - blocksStart), length);
+	blocks[length] = '\n';
+	blocks[length + 1] = '\0';
+	return blocks;
+}
+
+/*********************************************************************
+** Description: Reads a file by name and returns a string of the contents
+*********************************************************************/
+char* ReadFile(char* inFileName) {
+	//get text file
+	char* textIn;
+	size_t textInSize = 32;
+	size_t textInChars;
+	FILE* textInFD = fopen(inFileName, "r");
+	if (textInFD == NULL) {
+		fprintf(stderr, "CLIENT: could not open file %s\n", inFileName);
+		exit(1);
+	}
+	//prepare var for text
+	textIn = (char *)malloc(textInSize * sizeof(char));
+	if (textIn == NULL) {
+		error("CLIENT: unable to allocate space for input file");
+	}
+
+	textInChars = getline(&textIn, &textInSize, textInFD);
+	if (textInChars == 0) {
+		error("CLIENT: no message to read");
+	}
+	else if (textInChars == -1) {
+		error("CLIENT: failed to read file");
+	}
+	fclose(textInFD);
+
+	return textIn;
+}
+
+/*********************************************************************
+** Description: Reads symbols key characters starting offset bytes into
+**		the pad, stopping early at the pad's newline, into a zeroed
+**		buffer of bufferSize characters
+*********************************************************************/
+char* ReadKeyWindow(char* padPath, long long offset, size_t symbols, size_t bufferSize) {
+	int padFD = open(padPath, O_RDONLY);
+	if (padFD < 0) {
+		fprintf(stderr, "CLIENT: could not open file %s\n", padPath);
+		exit(1);
+	}
+	char* key = calloc(bufferSize + 1, sizeof(char));
+	if (key == NULL) error("CLIENT: unable to allocate space for key");
+
+	//only the window this message uses is read, however large the pad
+	ReadKeyChunk(padFD, offset, key, symbols, offset == 0);
+	close(padFD);
+	return key;
+}
+
+/*********************************************************************
+** Description: Reads up to symbols characters of the pad from offset
+**		into key, stopping at the newline that ends the pad; a pipe
+**		can stand in for the pad when it is read in order from the
+**		start. Returns the characters read
+*********************************************************************/
+static size_t ReadKeyChunk(int padFD, long long offset, char* key, size_t symbols, int sequential) {
+	size_t keyChars = 0;
+	while (keyChars < symbols) {
+		long charsRead = pread(padFD, key + keyChars, symbols - keyChars, offset + keyChars);
+		if (charsRead < 0 && errno == ESPIPE && sequential) charsRead = read(padFD, key + keyChars, symbols - keyChars);
+		if (charsRead < 0 && errno == EINTR) continue;
+		if (charsRead < 0) error("CLIENT: failed to read key");
+		if (charsRead == 0) break;
+		keyChars += charsRead;
+	}
+
+	char* newline = memchr(key, '\n', keyChars);
+	if (newline != NULL) { // the pad ends here
+		memset(newline, '\0', keyChars - (newline - key));
+		keyChars = newline - key;
+	}
+	return keyChars;
+}
+
+/*********************************************************************
+** Description: Names a pad by a checksum of its first block, so the
+**		same pad is recognised after a rename or a copy to another
+**		machine, where its device and inode differ
+*********************************************************************/
+static void PadId(const char* padPath, char* id, size_t idSize) {
+	int padFD = open(padPath, O_RDONLY);
+	if (padFD < 0) {
+		fprintf(stderr, "CLIENT: could not open file %s\n", padPath);
+		exit(1);
+	}
+	char* block = malloc(OTP_CONTAINER_BLOCK);
+	if (block == NULL) error("CLIENT: unable to allocate pad block");
+	size_t blockLength = 0;
+	ssize_t charsRead;
+	while (blockLength < OTP_CONTAINER_BLOCK && (charsRead = read(padFD, block + blockLength, OTP_CONTAINER_BLOCK - blockLength)) != 0) {
+		if (charsRead < 0) {
+			if (errno == EINTR) continue;
+			error("CLIENT: ERROR reading pad");
+		}
+		blockLength += charsRead;
+	}
+	close(padFD);
+	snprintf(id, idSize, "%08x", BlockChecksum(block, blockLength));
+	free(block);
+}
+
+/*********************************************************************
+** Description: Returns offset, or the end of the last recorded range of
+**		the pad when offset is -1; exits if a client that may not
+**		reuse key asks for a range that overlaps a recorded one
+*********************************************************************/
+static long long NextKeyOffset(struct ClientMode* mode, FILE* ledger, const char* padId, long long offset, size_t length) {
+	char id[64];
+	long long start;
+	size_t used;
+	long long next = 0;
+
+	rewind(ledger);
+	while (fscanf(ledger, "%63s %lld %zu", id, &start, &used) == 3) {
+		if (strcmp(id, padId) != 0) continue;
+		if (start + (long long)used > next) next = start + used;
+		if (mode->keyOnce && offset >= 0 && offset < start + (long long)used && start < offset + (long long)length) {
+			fprintf(stderr, "CLIENT: key range %lld length %zu overlaps range %lld length %zu already used\n", offset, length, start, used);
+			exit(1);
+		}
+	}
+	return offset >= 0 ? offset : next; // only encryption gets here without an offset
+}
+
+/*********************************************************************
+** Description: Scans the text and cipher text to ensure they
+**		have valid contents for the program
+*********************************************************************/
+int ValidateFiles(struct ClientMode* mode, char* text, char* key) {
+	size_t textLength = strlen(text);
+	size_t keyLength = strlen(key);
+	if (keyLength < textLength - (textLength > 0 && text[textLength - 1] == '\n')) {
+		fprintf(stderr, "CLIENT: key is too short for message\n");
+		return 0;
+	}
+	if (mode->validText(alphabet, text, textLength) != 1) {
+		fprintf(stderr, "CLIENT: invalid characters detected in %s", mode->textName);
+		return 0;
+	}
+	if (OtpCodecValidCipherText(alphabet, key, keyLength) != 1) {
+		fprintf(stderr, "CLIENT: invalid characters detected in key");
+		return 0;
+	}
+	return 1;
+}
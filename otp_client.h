@@ -0,0 +1,26 @@
+/*********************************************************************
+** Program: otp_client.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Request logic shared by otp_enc and otp_dec
+*********************************************************************/
+#ifndef OTP_CLIENT_H
+#define OTP_CLIENT_H
+
+#include <stddef.h>
+#include "otp_codec.h"
+
+// What distinguishes one client from the other
+struct ClientMode {
+	char* progName; // name this client identifies itself with
+	char* daemonName; // the only daemon this client talks to
+	char* textReq; // message the daemon sends to ask for the text
+	char* textName; // what the text is called in error messages
+	char* textArg; // what the text file is called in the usage message
+	int (*validText)(const struct OtpAlphabet* alphabet, const char* text, size_t length); // OtpCodecValidPlainText or OtpCodecValidCipherText
+	int keyOnce; // 1 if a recorded key range may never be used again, as for encryption
+};
+
+int RunClient(struct ClientMode* mode, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,113 @@
+/*********************************************************************
+** Program: otp_codec.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Alphabet definitions and the table driven kernels that
+**		encrypt, decrypt and validate text in any of them
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "otp_codec.h"
+
+// Every alphabet the programs know; the tables are all filled in once, on first use
+static struct OtpAlphabet alphabets[] = {
+	// the original 26 capitals and space, where a space travels as '@'
+	{ "az27", " ABCDEFGHIJKLMNOPQRSTUVWXYZ", "@ABCDEFGHIJKLMNOPQRSTUVWXYZ" },
+	{ "base36", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ", "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ" },
+	// every printable ASCII character, space through tilde
+	{ "printable",
+		" !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~",
+		" !\"#$%&'()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~" },
+};
+static pthread_once_t tablesBuilt = PTHREAD_ONCE_INIT;
+
+/*********************************************************************
+** Description: Generates the lookup tables for an alphabet from its
+**		symbol strings
+*********************************************************************/
+static void BuildTables(struct OtpAlphabet* alphabet) {
+	alphabet->modulus = strlen(alphabet->plainSymbols);
+	for (int i = 0; i < alphabet->modulus; i++) {
+		unsigned char plain = alphabet->plainSymbols[i];
+		unsigned char cipher = alphabet->cipherSymbols[i];
+		alphabet->plainIndex[plain] = i;
+		alphabet->isPlain[plain] = 1;
+		alphabet->cipherIndex[cipher] = i;
+		alphabet->isCipher[cipher] = 1;
+	}
+	for (int i = 0; i < 2 * alphabet->modulus; i++) {
+		alphabet->wrap[i] = i % alphabet->modulus;
+	}
+}
+
+/*********************************************************************
+** Description: Builds every alphabet's tables; run through pthread_once
+**		so no thread can see an alphabet half built
+*********************************************************************/
+static void BuildAllTables() {
+	for (int i = 0; i < sizeof(alphabets) / sizeof(alphabets[0]); i++) {
+		BuildTables(&alphabets[i]);
+	}
+}
+
+/*********************************************************************
+** Description: Returns the alphabet with the given name, or NULL if
+**		there isn't one; safe to call from any thread
+*********************************************************************/
+const struct OtpAlphabet* OtpCodecFindAlphabet(const char* name) {
+	pthread_once(&tablesBuilt, BuildAllTables);
+	for (int i = 0; i < sizeof(alphabets) / sizeof(alphabets[0]); i++) {
+		if (strcmp(alphabets[i].name, name) == 0) return &alphabets[i];
+	}
+	return NULL;
+}
+
+/*********************************************************************
+** Description: Encrypts text[start, end) in place with the matching
+**		key characters; characters outside the alphabet pass through
+*********************************************************************/
+void OtpCodecEncryptText(const void* alphabet, char* text, const char* key, size_t start, size_t end) {
+	const struct OtpAlphabet* a = alphabet;
+	for (size_t i = start; i < end; i++) {
+		unsigned char in = text[i];
+		unsigned char sum = a->wrap[a->plainIndex[in] + a->cipherIndex[(unsigned char)key[i]]];
+		text[i] = a->isPlain[in] ? a->cipherSymbols[sum] : in;
+	}
+}
+
+/*********************************************************************
+** Description: Decrypts text[start, end) in place with the matching
+**		key characters; characters outside the alphabet pass through
+*********************************************************************/
+void OtpCodecDecryptText(const void* alphabet, char* text, const char* key, size_t start, size_t end) {
+	const struct OtpAlphabet* a = alphabet;
+	for (size_t i = start; i < end; i++) {
+		unsigned char in = text[i];
+		unsigned char difference = a->wrap[a->cipherIndex[in] + a->modulus - a->cipherIndex[(unsigned char)key[i]]];
+		text[i] = a->isCipher[in] ? a->plainSymbols[difference] : in;
+	}
+}
+
+/*********************************************************************
+** Description: Returns 1 if every character of text is a plaintext
+**		symbol or a newline
+*********************************************************************/
+int OtpCodecValidPlainText(const struct OtpAlphabet* alphabet, const char* text, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (alphabet->isPlain[(unsigned char)text[i]] == 0 && text[i] != '\n') return 0;
+	}
+	return 1;
+}
+
+/*********************************************************************
+** Description: Returns 1 if every character of text is a ciphertext
+**		or key symbol or a newline
+*********************************************************************/
+int OtpCodecValidCipherText(const struct OtpAlphabet* alphabet, const char* text, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (alphabet->isCipher[(unsigned char)text[i]] == 0 && text[i] != '\n') return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,35 @@
+/*********************************************************************
+** Program: otp_codec.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Alphabet definitions and the table driven kernels that
+**		encrypt, decrypt and validate text in any of them
+*********************************************************************/
+#ifndef OTP_CODEC_H
+#define OTP_CODEC_H
+
+#include <stddef.h>
+
+#define OTP_MAX_SYMBOLS 128
+#define OTP_DEFAULT_ALPHABET "az27"
+
+// A set of symbols and the lookup tables generated from it
+struct OtpAlphabet {
+	const char* name;
+	const char* plainSymbols; // index -> plaintext character
+	const char* cipherSymbols; // index -> ciphertext and key character, differs only in separator handling
+	int modulus;
+	unsigned char plainIndex[256]; // plaintext character -> index
+	unsigned char cipherIndex[256]; // ciphertext or key character -> index
+	unsigned char isPlain[256]; // 1 if the character belongs to the plaintext symbols
+	unsigned char isCipher[256]; // 1 if the character belongs to the ciphertext symbols
+	unsigned char wrap[2 * OTP_MAX_SYMBOLS]; // i -> i % modulus, so the kernels never divide
+};
+
+const struct OtpAlphabet* OtpCodecFindAlphabet(const char* name);
+void OtpCodecEncryptText(const void* alphabet, char* text, const char* key, size_t start, size_t end);
+void OtpCodecDecryptText(const void* alphabet, char* text, const char* key, size_t start, size_t end);
+int OtpCodecValidPlainText(const struct OtpAlphabet* alphabet, const char* text, size_t length);
+int OtpCodecValidCipherText(const struct OtpAlphabet* alphabet, const char* text, size_t length);
+
+#endif
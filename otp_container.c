@@ -0,0 +1,110 @@
+/*********************************************************************
+** Program: otp_container.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: A self-describing ciphertext file recording the pad
+**		range it was made with and a checksum per block, so any range
+**		of it can be read and checked without the rest
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "otp_container.h"
+#include "otp_net.h"
+
+// A container is one header line,
+//   OTPC1 pad=XXXXXXXX offset=N length=N block=N alphabet=name
+// with the pad named by the checksum of its first block, then 8 hex
+// digits of checksum per block and a newline, then the ciphertext and
+// a newline. Everything after the header sits at an offset computed
+// from it, so a reader seeks straight to any block.
+
+/*********************************************************************
+** Description: FNV-1a over one block; catches a damaged or truncated
+**		container, it is no defence against a deliberate change
+*********************************************************************/
+unsigned int BlockChecksum(const char* data, size_t length) {
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+/*********************************************************************
+** Description: Writes length characters of cipher to out as a
+**		container; returns 1 on success
+*********************************************************************/
+int WriteContainer(FILE* out, const char* padId, long long keyOffset, const char* alphabet, const char* cipher, size_t length) {
+	long long numBlocks = (length + OTP_CONTAINER_BLOCK - 1) / OTP_CONTAINER_BLOCK;
+	fprintf(out, "%s pad=%s offset=%lld length=%zu block=%d alphabet=%s\n", OTP_CONTAINER_MAGIC, padId, keyOffset, length, OTP_CONTAINER_BLOCK, alphabet);
+	for (long long i = 0; i < numBlocks; i++) {
+		size_t blockLength = i == numBlocks - 1 ? length - i * OTP_CONTAINER_BLOCK : OTP_CONTAINER_BLOCK;
+		fprintf(out, "%08x", BlockChecksum(cipher + i * OTP_CONTAINER_BLOCK, blockLength));
+	}
+	fputc('\n', out);
+	fwrite(cipher, 1, length, out);
+	fputc('\n', out);
+	return fflush(out) == 0 && ferror(out) == 0;
+}
+
+/*********************************************************************
+** Description: Reads the header of the file open as containerFD;
+**		returns 1 for a container, 0 for a file that is not one and
+**		-1 for one whose header makes no sense
+*********************************************************************/
+int ReadContainerHeader(int containerFD, struct ContainerHeader* header) {
+	char line[OTP_CONTAINER_HEADER_MAX + 1];
+	char value[64];
+	long charsRead = pread(containerFD, line, OTP_CONTAINER_HEADER_MAX, 0);
+	if (charsRead < (long)strlen(OTP_CONTAINER_MAGIC) + 1) return 0;
+	line[charsRead] = '\0';
+	if (strncmp(line, OTP_CONTAINER_MAGIC " ", strlen(OTP_CONTAINER_MAGIC) + 1) != 0) return 0;
+	char* newline = strchr(line, '\n');
+	if (newline == NULL) return -1;
+	*newline = '\0';
+
+	if (GetAttribute(line, "pad", header->padId, sizeof(header->padId)) != 1) return -1;
+	if (GetAttribute(line, "alphabet", header->alphabet, sizeof(header->alphabet)) != 1) return -1;
+	if (GetAttribute(line, "offset", value, sizeof(value)) != 1) return -1;
+	header->keyOffset = strtoll(value, NULL, 10);
+	if (GetAttribute(line, "length", value, sizeof(value)) != 1) return -1;
+	header->length = strtoll(value, NULL, 10);
+	if (GetAttribute(line, "block", value, sizeof(value)) != 1) return -1;
+	header->blockSize = strtoul(value, NULL, 10);
+	if (header->keyOffset < 0 || header->length < 0 || header->blockSize == 0) return -1;
+
+	long long numBlocks = (header->length + header->blockSize - 1) / header->blockSize;
+	header->tableOffset = newline - line + 1;
+	header->dataOffset = header->tableOffset + 8 * numBlocks + 1;
+	return 1;
+}
+
+/*********************************************************************
+** Description: Checks data, the whole blocks of ciphertext starting at
+**		firstBlock, against their stored checksums; returns the
+**		number of the first bad block, or -1 if all match
+*********************************************************************/
+long long CheckContainerBlocks(int containerFD, const struct ContainerHeader* header, long long firstBlock, const char* data, size_t length) {
+	long long numBlocks = (length + header->blockSize - 1) / header->blockSize;
+	char* table = malloc(8 * numBlocks + 1);
+	if (table == NULL) return firstBlock;
+	if (pread(containerFD, table, 8 * numBlocks, header->tableOffset + 8 * firstBlock) != 8 * numBlocks) {
+		free(table);
+		return firstBlock;
+	}
+	for (long long i = 0; i < numBlocks; i++) {
+		char stored[9];
+		memcpy(stored, table + 8 * i, 8);
+		stored[8] = '\0';
+		size_t blockLength = i == numBlocks - 1 ? length - i * header->blockSize : header->blockSize;
+		if (strtoul(stored, NULL, 16) != BlockChecksum(data + i * header->blockSize, blockLength)) {
+			free(table);
+			return firstBlock + i;
+		}
+	}
+	free(table);
+	return -1;
+}
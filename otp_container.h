@@ -0,0 +1,35 @@
+/*********************************************************************
+** Program: otp_container.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: A self-describing ciphertext file recording the pad
+**		range it was made with and a checksum per block, so any range
+**		of it can be read and checked without the rest
+*********************************************************************/
+#ifndef OTP_CONTAINER_H
+#define OTP_CONTAINER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define OTP_CONTAINER_MAGIC "OTPC1"
+#define OTP_CONTAINER_BLOCK 65536 // ciphertext characters covered by one checksum
+#define OTP_CONTAINER_HEADER_MAX 512 // longest header line a reader accepts
+
+// What the header line says, and where the parts after it start
+struct ContainerHeader {
+	char padId[64]; // pad the key came from, as the checksum of its first block
+	long long keyOffset; // where in the pad the key starts
+	long long length; // ciphertext characters, not counting the final newline
+	size_t blockSize;
+	char alphabet[32];
+	long long tableOffset; // first byte of the checksums, 8 hex digits per block
+	long long dataOffset; // first byte of the ciphertext
+};
+
+unsigned int BlockChecksum(const char* data, size_t length);
+int WriteContainer(FILE* out, const char* padId, long long keyOffset, const char* alphabet, const char* cipher, size_t length);
+int ReadContainerHeader(int containerFD, struct ContainerHeader* header);
+long long CheckContainerBlocks(int containerFD, const struct ContainerHeader* header, long long firstBlock, const char* data, size_t length);
+
+#endif
@@ -0,0 +1,299 @@
+/*********************************************************************
+** Program: otp_key_d.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Keeps a pool of random bytes filled from the kernel's
+**		CSPRNG in the background and hands each client a fresh key
+**		of the length and alphabet it asks for; no byte of the pool
+**		is ever handed out twice
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+#include "otp_net.h"
+#include "otp_codec.h"
+
+#define DEFAULT_POOL_SIZE (64 << 20) // random bytes kept ready
+#define FILL_CHUNK 65536 // bytes drawn from the kernel at a time
+#define MAX_KEY_LENGTH (1 << 30) // longest key one request may ask for
+#define KEY_CHUNK 65536 // key characters made and sent at a time
+#define MAX_KEY_CLIENTS 64 // connections served at once
+#define IDLE_TIMEOUT 10000 // ms a client may go without sending or receiving
+#define REQUEST_TIMEOUT 60000 // ms a whole request may take
+
+// Ring of random bytes; the filler appends at head + filled and requests
+// take from head, so the two never touch the same bytes
+struct EntropyPool {
+	unsigned char* ring;
+	size_t capacity;
+	size_t head; // oldest unused byte
+	size_t filled; // unused bytes from head on
+	pthread_mutex_t lock;
+	pthread_cond_t dataReady; // signalled when bytes are added
+	pthread_cond_t spaceFree; // signalled when bytes are taken
+	long waits; // times a request found the pool empty
+};
+
+//prototypes
+void* FillPool(void* arg);
+void TakeRandom(unsigned char* out, size_t length);
+void MakeKey(const struct OtpAlphabet* alphabet, char* key, size_t length);
+void* ServeClient(void* arg);
+void DumpStats();
+void NoteDumpRequest(int signalNumber);
+
+void error(const char *msg) { perror(msg); exit(1); } // Error function used for reporting issues
+
+struct EntropyPool pool = { NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+volatile int activeClients;
+volatile long keysServed;
+volatile long long symbolsServed;
+volatile long refused; // connections turned away, see MAX_KEY_CLIENTS
+volatile sig_atomic_t dumpRequested;
+
+/*********************************************************************
+** Description: Fills the pool, then serves each connection on its own
+**		thread while the pool is topped up in the background
+*********************************************************************/
+int main(int argc, char *argv[]) {
+	size_t poolSize = DEFAULT_POOL_SIZE;
+	static struct option longOptions[] = {
+		{ "pool", required_argument, NULL, 'p' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int option;
+	while ((option = getopt_long(argc, argv, "p:", longOptions, NULL)) != -1) {
+		switch (option) {
+		case 'p':
+			poolSize = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			exit(1);
+		}
+	}
+	if (optind >= argc || poolSize < FILL_CHUNK) { fprintf(stderr, "KEYD: USAGE: %s [--pool bytes] port\n", argv[0]); exit(1); } // Check usage & args
+
+	//pad material stays out of swap where the system allows it
+	pool.capacity = poolSize;
+	pool.ring = mmap(NULL, poolSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pool.ring == MAP_FAILED) error("KEYD: ERROR mapping entropy pool");
+	if (mlock(pool.ring, poolSize) != 0) fprintf(stderr, "KEYD: could not lock the entropy pool in memory, it may be swapped\n");
+
+	// Set up the socket
+	struct sockaddr_in serverAddress;
+	memset((char *)&serverAddress, '\0', sizeof(serverAddress)); // Clear out the address struct
+	serverAddress.sin_family = AF_INET; // Create a network-capable socket
+	serverAddress.sin_port = htons(atoi(argv[optind])); // Store the port number
+	serverAddress.sin_addr.s_addr = INADDR_ANY; // Any address is allowed for connection to this process
+	int listenSocketFD = socket(AF_INET, SOCK_STREAM, 0); // Create the socket
+	if (listenSocketFD < 0) error("KEYD: ERROR opening socket");
+	if (bind(listenSocketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0) // Connect socket to port
+		error("KEYD: ERROR on binding");
+
+	//the first requests shouldn't wait on the kernel, so the pool starts full
+	pthread_t filler;
+	if (pthread_create(&filler, NULL, FillPool, NULL) != 0) error("KEYD: ERROR starting pool filler");
+	pthread_mutex_lock(&pool.lock);
+	while (pool.filled < pool.capacity) pthread_cond_wait(&pool.dataReady, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+	listen(listenSocketFD, 64);
+
+	struct sigaction dumpAction;
+	memset(&dumpAction, 0, sizeof(dumpAction));
+	dumpAction.sa_handler = NoteDumpRequest;
+	sigaction(SIGUSR1, &dumpAction, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (1) {
+		if (dumpRequested) DumpStats();
+		int connectedSocketFD = accept(listenSocketFD, NULL, NULL);
+		if (connectedSocketFD < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			error("KEYD: ERROR on accept");
+		}
+		if (__sync_add_and_fetch(&activeClients, 1) > MAX_KEY_CLIENTS) {
+			__sync_sub_and_fetch(&activeClients, 1);
+			__sync_fetch_and_add(&refused, 1);
+			close(connectedSocketFD);
+			continue;
+		}
+
+		pthread_t client;
+		pthread_attr_t detached;
+		pthread_attr_init(&detached);
+		pthread_attr_setdetachstate(&detached, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&client, &detached, ServeClient, (void*)(intptr_t)connectedSocketFD) != 0) {
+			__sync_sub_and_fetch(&activeClients, 1);
+			close(connectedSocketFD);
+		}
+		pthread_attr_destroy(&detached);
+	}
+	return 0;
+}
+
+/*********************************************************************
+** Description: Runs on its own thread; keeps the pool topped up from
+**		the kernel's CSPRNG
+*********************************************************************/
+void* FillPool(void* arg) {
+	while (1) {
+		pthread_mutex_lock(&pool.lock);
+		while (pool.filled == pool.capacity) pthread_cond_wait(&pool.spaceFree, &pool.lock);
+		size_t tail = (pool.head + pool.filled) % pool.capacity;
+		size_t length = pool.capacity - pool.filled;
+		if (length > pool.capacity - tail) length = pool.capacity - tail; // up to the end of the ring
+		if (length > FILL_CHUNK) length = FILL_CHUNK;
+		pthread_mutex_unlock(&pool.lock);
+
+		//the bytes past filled are the filler's alone, so no lock is needed to write them
+		size_t curByte = 0;
+		while (curByte < length) {
+			long bytesRead = getrandom(pool.ring + tail + curByte, length - curByte, 0);
+			if (bytesRead < 0) {
+				if (errno == EINTR) continue;
+				error("KEYD: ERROR reading random bytes");
+			}
+			curByte += bytesRead;
+		}
+
+		pthread_mutex_lock(&pool.lock);
+		pool.filled += length;
+		pthread_cond_broadcast(&pool.dataReady);
+		pthread_mutex_unlock(&pool.lock);
+	}
+	return NULL;
+}
+
+/*********************************************************************
+** Description: Moves length bytes out of the pool, waiting for the
+**		filler if it runs dry; the pool's copy is wiped
+*********************************************************************/
+void TakeRandom(unsigned char* out, size_t length) {
+	pthread_mutex_lock(&pool.lock);
+	while (length > 0) {
+		if (pool.filled == 0) {
+			pool.waits++;
+			while (pool.filled == 0) pthread_cond_wait(&pool.dataReady, &pool.lock);
+		}
+		size_t chunk = pool.filled;
+		if (chunk > length) chunk = length;
+		if (chunk > pool.capacity - pool.head) chunk = pool.capacity - pool.head; // up to the end of the ring
+		memcpy(out, pool.ring + pool.head, chunk);
+		memset(pool.ring + pool.head, 0, chunk); // never handed out again
+		pool.head = (pool.head + chunk) % pool.capacity;
+		pool.filled -= chunk;
+		out += chunk;
+		length -= chunk;
+		pthread_cond_signal(&pool.spaceFree);
+	}
+	pthread_mutex_unlock(&pool.lock);
+}
+
+/*********************************************************************
+** Description: Fills key with length symbols of the alphabet; random
+**		bytes past the largest multiple of the alphabet's size are
+**		skipped so every symbol is equally likely
+*********************************************************************/
+void MakeKey(const struct OtpAlphabet* alphabet, char* key, size_t length) {
+	unsigned char random[4096];
+	int limit = 256 - 256 % alphabet->modulus;
+	size_t curChar = 0;
+	while (curChar < length) {
+		size_t wanted = length - curChar;
+		wanted += wanted / 4 + 16; // a little extra covers the skipped bytes
+		if (wanted > sizeof(random)) wanted = sizeof(random);
+		TakeRandom(random, wanted);
+		for (size_t i = 0; i < wanted && curChar < length; i++) {
+			if (random[i] < limit) key[curChar++] = alphabet->cipherSymbols[random[i] % alphabet->modulus];
+		}
+	}
+	memset(random, 0, sizeof(random));
+}
+
+/*********************************************************************
+** Description: Runs on its own thread; answers one "otp_key size=n"
+**		request, with an optional alphabet=, with a header line
+**		"otp_key_d serial=s" followed by n key characters, made and
+**		sent KEY_CHUNK at a time so no request holds more than that
+*********************************************************************/
+void* ServeClient(void* arg) {
+	int clientSocket = (intptr_t)arg;
+	char buffer[1024];
+	memset(buffer, '\0', sizeof(buffer));
+
+	//a stalled client only ties up its own thread, and not for long
+	fcntl(clientSocket, F_SETFL, fcntl(clientSocket, F_GETFL) | O_NONBLOCK);
+	SetSocketDeadlines(IDLE_TIMEOUT, MonotonicMs() + REQUEST_TIMEOUT);
+
+	long charsRead = RecvSome(clientSocket, buffer, sizeof(buffer) - 1);
+	if (charsRead <= 0) goto done;
+	char sizeValue[32], alphabetName[64];
+	const struct OtpAlphabet* alphabet = OtpCodecFindAlphabet(OTP_DEFAULT_ALPHABET);
+	buffer[strcspn(buffer, "\n")] = '\0';
+	if (strncmp(buffer, "otp_key", 7) != 0 || (buffer[7] != ' ' && buffer[7] != '\0')) {
+		SendAll(clientSocket, "no", 2); // Send a bogus message to tell client to kill itself
+		goto done;
+	}
+	if (GetAttribute(buffer, "alphabet", alphabetName, sizeof(alphabetName)) == 1) alphabet = OtpCodecFindAlphabet(alphabetName);
+	size_t length = GetAttribute(buffer, "size", sizeValue, sizeof(sizeValue)) == 1 ? strtoul(sizeValue, NULL, 10) : 0;
+	if (alphabet == NULL || length == 0 || length > MAX_KEY_LENGTH) {
+		char* reply = alphabet == NULL ? "otp_key_d error=alphabet\n" : "otp_key_d error=size\n";
+		SendAll(clientSocket, reply, strlen(reply));
+		goto done;
+	}
+
+	char key[KEY_CHUNK];
+	char header[64];
+	sprintf(header, "otp_key_d serial=%ld\n", __sync_add_and_fetch(&keysServed, 1));
+	int sent = SendAll(clientSocket, header, strlen(header));
+	for (size_t curChar = 0; sent == 1 && curChar < length; curChar += KEY_CHUNK) {
+		size_t chunk = length - curChar < KEY_CHUNK ? length - curChar : KEY_CHUNK;
+		MakeKey(alphabet, key, chunk);
+		sent = SendAll(clientSocket, key, chunk);
+	}
+	if (sent == 1) __sync_fetch_and_add(&symbolsServed, (long long)length);
+	memset(key, 0, sizeof(key));
+
+done:
+	close(clientSocket);
+	__sync_sub_and_fetch(&activeClients, 1);
+	return NULL;
+}
+
+/*********************************************************************
+** Description: Prints the counters to stderr as name value lines
+*********************************************************************/
+void DumpStats() {
+	dumpRequested = 0;
+	pthread_mutex_lock(&pool.lock);
+	size_t filled = pool.filled;
+	long waits = pool.waits;
+	pthread_mutex_unlock(&pool.lock);
+	fprintf(stderr, "keys_served %ld\n", keysServed);
+	fprintf(stderr, "symbols_served %lld\n", symbolsServed);
+	fprintf(stderr, "active_clients %d\n", activeClients);
+	fprintf(stderr, "refused_clients %ld\n", refused);
+	fprintf(stderr, "pool_bytes %zu\n", pool.capacity);
+	fprintf(stderr, "pool_filled %zu\n", filled);
+	fprintf(stderr, "pool_empty_waits %ld\n", waits);
+}
+
+/*********************************************************************
+** Description: SIGUSR1 handler; the accept loop prints the counters
+*********************************************************************/
+void NoteDumpRequest(int signalNumber) {
+	dumpRequested = 1;
+}
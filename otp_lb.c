@@ -0,0 +1,415 @@
+/*********************************************************************
+** Program: otp_lb.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Accepts otp_enc or otp_dec connections on one port and
+**		forwards each job to the least busy healthy daemon in a
+**		configured set of otp_enc_d or otp_dec_d backends, which a
+**		separate process health checks
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include "otp_net.h"
+
+#define MAX_BACKENDS 32
+#define MAX_LB_CHILDREN 64
+#define HEALTH_INTERVAL 2 // seconds between health check sweeps
+#define HEALTH_TIMEOUT 3000 // ms allowed for a backend to connect and handshake
+#define EJECT_THRESHOLD 3 // consecutive failures before a backend is ejected
+#define CLIENT_HANDSHAKE_TIMEOUT 10000 // ms a client gets to identify itself
+#define RELAY_IDLE_TIMEOUT 60000 // ms a relay may go without either side sending
+#define RELAY_BUFFER 65536
+
+// One backend daemon, kept in memory shared by the parent and every child
+struct Backend {
+	char name[300];
+	struct sockaddr_in address;
+	volatile int outstanding; // jobs currently being relayed to this backend
+	volatile int healthy;
+	volatile int consecutiveFails;
+	volatile long served;
+};
+
+//prototypes
+int ParseBackend(char* spec, struct Backend* backend);
+int ConnectBackend(struct Backend* backend, int timeoutMs);
+int Handshake(int backendSocket, const char* hello, int timeoutMs);
+void HealthCheck(struct Backend* backend);
+pid_t StartHealthChecker(void);
+void MarkFailure(struct Backend* backend);
+void MarkSuccess(struct Backend* backend);
+struct Backend* PickBackend(int* tried);
+void HandleClient(int clientSocket);
+void Relay(int clientSocket, int backendSocket);
+
+void error(const char *msg) { perror(msg); exit(1); } // Error function used for reporting issues
+
+struct Backend* backends; // shared mapping, see main
+int numBackends;
+char* clientName; // name the clients of this balancer identify with
+char* daemonName; // name the backends answer the handshake with
+
+/*********************************************************************
+** Description: Parses the backend list, starts the health checker,
+**		then accepts connections and forks a child to relay each one
+*********************************************************************/
+int main(int argc, char *argv[]) {
+	int listenSocketFD, portNumber;
+	socklen_t sizeOfClientInfo;
+	struct sockaddr_in serverAddress, clientAddress;
+
+	if (argc < 4) { fprintf(stderr, "LB: USAGE: %s enc|dec port [host:]port ...\n", argv[0]); exit(1); } // Check usage & args
+
+	if (strcmp(argv[1], "enc") == 0) {
+		clientName = "otp_enc";
+		daemonName = "otp_enc_d";
+	}
+	else if (strcmp(argv[1], "dec") == 0) {
+		clientName = "otp_dec";
+		daemonName = "otp_dec_d";
+	}
+	else {
+		fprintf(stderr, "LB: mode must be enc or dec, not %s\n", argv[1]);
+		exit(1);
+	}
+
+	// Backend state lives in a shared mapping so forked children can update load and failures
+	backends = mmap(NULL, MAX_BACKENDS * sizeof(struct Backend), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (backends == MAP_FAILED) error("LB: ERROR mapping backend table");
+	numBackends = 0;
+	for (int i = 3; i < argc; i++) {
+		if (numBackends == MAX_BACKENDS) { fprintf(stderr, "LB: at most %d backends are supported\n", MAX_BACKENDS); exit(1); }
+		if (ParseBackend(argv[i], &backends[numBackends]) != 1) {
+			fprintf(stderr, "LB: could not resolve backend %s\n", argv[i]);
+			exit(1);
+		}
+		numBackends++;
+	}
+
+	signal(SIGPIPE, SIG_IGN); // a vanished peer should fail a send, not kill the relay
+
+	// Set up the address struct for this process (the server)
+	memset((char *)&serverAddress, '\0', sizeof(serverAddress)); // Clear out the address struct
+	portNumber = atoi(argv[2]); // Get the port number, convert to an integer from a string
+	serverAddress.sin_family = AF_INET; // Create a network-capable socket
+	serverAddress.sin_port = htons(portNumber); // Store the port number
+	serverAddress.sin_addr.s_addr = INADDR_ANY; // Any address is allowed for connection to this process
+
+	// Set up the socket
+	listenSocketFD = socket(AF_INET, SOCK_STREAM, 0); // Create the socket
+	if (listenSocketFD < 0) error("LB: ERROR opening socket");
+	int yes = 1;
+	setsockopt(listenSocketFD, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+
+	// Enable the socket to begin listening
+	if (bind(listenSocketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0) // Connect socket to port
+		error("LB: ERROR on binding");
+	listen(listenSocketFD, 64);
+
+	// Find out which backends are up before taking traffic
+	for (int i = 0; i < numBackends; i++) {
+		HealthCheck(&backends[i]);
+	}
+	pid_t checkerPid = StartHealthChecker();
+
+	int numChildProcs = 0;
+	while (1) {
+		//reap any finished relays, restarting the health checker if it died
+		pid_t donePid;
+		while ((donePid = waitpid(-1, NULL, WNOHANG)) > 0) {
+			if (donePid == checkerPid) checkerPid = StartHealthChecker();
+			else numChildProcs--;
+		}
+
+		//wait for a connection, waking up now and then to reap
+		struct pollfd listenPoll = { listenSocketFD, POLLIN, 0 };
+		if (numChildProcs >= MAX_LB_CHILDREN) listenPoll.events = 0;
+		int ready = poll(&listenPoll, 1, 1000);
+		if (ready < 0 && errno != EINTR) error("LB: ERROR polling listen socket");
+		if (ready <= 0 || (listenPoll.revents & POLLIN) == 0) continue;
+
+		sizeOfClientInfo = sizeof(clientAddress); // Get the size of the address for the client that will connect
+		int connectedSocketFD = accept(listenSocketFD, (struct sockaddr *)&clientAddress, &sizeOfClientInfo); // Accept
+		if (connectedSocketFD < 0) {
+			perror("LB: ERROR on accept");
+			continue;
+		}
+
+		pid_t spawnPid = fork();
+		switch (spawnPid) {
+		case 0://this is the child process
+			close(listenSocketFD);
+			HandleClient(connectedSocketFD);
+			exit(0);
+			break;
+		case -1://something has gone terribly wrong
+			perror("LB: failed to fork");
+			close(connectedSocketFD);
+			break;
+		default://this is the parent process
+			close(connectedSocketFD);
+			numChildProcs++;
+			break;
+		}
+	}
+	close(listenSocketFD); // Close the listening socket
+
+	return 0;
+}
+
+/*********************************************************************
+** Description: Fills in a backend from a "host:port" or "port" string,
+**		returns 1 on success
+*********************************************************************/
+int ParseBackend(char* spec, struct Backend* backend) {
+	char host[256] = "localhost";
+	char* portText = spec;
+	char* colon = strrchr(spec, ':');
+	if (colon != NULL) {
+		if (colon - spec >= sizeof(host)) return 0;
+		memcpy(host, spec, colon - spec);
+		host[colon - spec] = '\0';
+		portText = colon + 1;
+	}
+	if (atoi(portText) <= 0) return 0;
+
+	struct hostent* hostInfo = gethostbyname(host); // Convert the machine name into a special form of address
+	if (hostInfo == NULL) return 0;
+
+	memset(backend, '\0', sizeof(*backend));
+	snprintf(backend->name, sizeof(backend->name), "%s:%s", host, portText);
+	backend->address.sin_family = AF_INET;
+	backend->address.sin_port = htons(atoi(portText));
+	memcpy((char*)&backend->address.sin_addr.s_addr, (char*)hostInfo->h_addr, hostInfo->h_length);
+	backend->healthy = 1; // assumed up until the first health check says otherwise
+	return 1;
+}
+
+/*********************************************************************
+** Description: Opens a connection to a backend, giving up after
+**		timeoutMs, returns the socket or -1
+*********************************************************************/
+int ConnectBackend(struct Backend* backend, int timeoutMs) {
+	int socketFD = socket(AF_INET, SOCK_STREAM, 0);
+	if (socketFD < 0) return -1;
+
+	//connect without blocking so a dead host can't stall us
+	int flags = fcntl(socketFD, F_GETFL, 0);
+	fcntl(socketFD, F_SETFL, flags | O_NONBLOCK);
+	if (connect(socketFD, (struct sockaddr*)&backend->address, sizeof(backend->address)) < 0) {
+		if (errno != EINPROGRESS) { close(socketFD); return -1; }
+		struct pollfd connectPoll = { socketFD, POLLOUT, 0 };
+		int connectError = 0;
+		socklen_t errorSize = sizeof(connectError);
+		if (poll(&connectPoll, 1, timeoutMs) != 1
+			|| getsockopt(socketFD, SOL_SOCKET, SO_ERROR, &connectError, &errorSize) < 0
+			|| connectError != 0) {
+			close(socketFD);
+			return -1;
+		}
+	}
+	fcntl(socketFD, F_SETFL, flags);
+	return socketFD;
+}
+
+/*********************************************************************
+** Description: Identifies to the backend with hello, a client's own
+**		handshake so its attributes such as tenant= reach the daemon,
+**		returns 1 if the backend answered with the expected daemon name
+*********************************************************************/
+int Handshake(int backendSocket, const char* hello, int timeoutMs) {
+	char buffer[1024];
+	memset(buffer, '\0', sizeof(buffer));
+
+	if (SendAll(backendSocket, hello, strlen(hello)) != 1) return 0;
+
+	struct pollfd replyPoll = { backendSocket, POLLIN, 0 };
+	if (poll(&replyPoll, 1, timeoutMs) != 1) return 0;
+	int charsRead = recv(backendSocket, buffer, sizeof(buffer) - 1, 0); // Read data from the socket, leaving \0 at end
+	if (charsRead <= 0) return 0;
+
+	return strcmp(buffer, daemonName) == 0;
+}
+
+/*********************************************************************
+** Description: Probes a backend with a connect and handshake and
+**		updates its health
+*********************************************************************/
+void HealthCheck(struct Backend* backend) {
+	int socketFD = ConnectBackend(backend, HEALTH_TIMEOUT);
+	if (socketFD >= 0 && Handshake(socketFD, clientName, HEALTH_TIMEOUT) == 1) {
+		MarkSuccess(backend);
+	}
+	else {
+		MarkFailure(backend);
+	}
+	if (socketFD >= 0) close(socketFD);
+}
+
+/*********************************************************************
+** Description: Forks the process that sweeps the backends every
+**		HEALTH_INTERVAL seconds, so a slow probe never holds up an
+**		accept; it exits once the balancer is gone
+*********************************************************************/
+pid_t StartHealthChecker(void) {
+	pid_t parentPid = getpid();
+	pid_t spawnPid = fork();
+	if (spawnPid < 0) error("LB: failed to fork health checker");
+	if (spawnPid > 0) return spawnPid;
+
+	while (getppid() == parentPid) {
+		sleep(HEALTH_INTERVAL);
+		for (int i = 0; i < numBackends; i++) {
+			HealthCheck(&backends[i]);
+		}
+	}
+	exit(0);
+}
+
+/*********************************************************************
+** Description: Counts a failed probe or job against a backend and
+**		ejects it once it has failed too many times in a row
+*********************************************************************/
+void MarkFailure(struct Backend* backend) {
+	int fails = __sync_add_and_fetch(&backend->consecutiveFails, 1);
+	if (fails >= EJECT_THRESHOLD && __sync_bool_compare_and_swap(&backend->healthy, 1, 0)) {
+		fprintf(stderr, "LB: backend %s ejected after %d failures\n", backend->name, fails);
+	}
+}
+
+/*********************************************************************
+** Description: Clears a backend's failures and returns it to service
+*********************************************************************/
+void MarkSuccess(struct Backend* backend) {
+	backend->consecutiveFails = 0;
+	if (__sync_bool_compare_and_swap(&backend->healthy, 0, 1)) {
+		fprintf(stderr, "LB: backend %s is back in service\n", backend->name);
+	}
+}
+
+/*********************************************************************
+** Description: Chooses the healthy backend with the fewest outstanding
+**		jobs that hasn't been tried yet, falling back to ejected
+**		backends when no healthy one is left; returns NULL when
+**		every backend has been tried
+*********************************************************************/
+struct Backend* PickBackend(int* tried) {
+	struct Backend* best = NULL;
+	int start = getpid() % numBackends; // spread ties across backends
+
+	for (int pass = 0; pass < 2 && best == NULL; pass++) {
+		for (int n = 0; n < numBackends; n++) {
+			int i = (start + n) % numBackends;
+			if (tried[i] || (pass == 0 && !backends[i].healthy)) continue;
+			if (best == NULL || backends[i].outstanding < best->outstanding) {
+				best = &backends[i];
+			}
+		}
+	}
+	if (best != NULL) tried[best - backends] = 1;
+	return best;
+}
+
+/*********************************************************************
+** Description: Takes the client's handshake, finds a backend that
+**		accepts the same handshake, then relays the rest of the job
+*********************************************************************/
+void HandleClient(int clientSocket) {
+	char buffer[1024];
+	memset(buffer, '\0', sizeof(buffer));
+	int tried[MAX_BACKENDS] = { 0 };
+
+	//a client that connects and says nothing must not hold a relay slot
+	struct pollfd helloPoll = { clientSocket, POLLIN, 0 };
+	if (poll(&helloPoll, 1, CLIENT_HANDSHAKE_TIMEOUT) != 1) {
+		fprintf(stderr, "LB: client sent no handshake within %d ms\n", CLIENT_HANDSHAKE_TIMEOUT);
+		close(clientSocket);
+		return;
+	}
+	int charsRead = recv(clientSocket, buffer, sizeof(buffer) - 1, 0); // Read the client's handshake
+	if (charsRead < 0) error("LB: ERROR reading from socket");
+
+	//only the name is checked; the rest is the daemon's to read
+	char name[1024];
+	memcpy(name, buffer, sizeof(name));
+	name[strcspn(name, " ")] = '\0';
+	if (strcmp(name, clientName) != 0) {
+		SendAll(clientSocket, "no", 2); // tell the wrong client to give up
+		close(clientSocket);
+		return;
+	}
+
+	struct Backend* backend;
+	while ((backend = PickBackend(tried)) != NULL) {
+		__sync_add_and_fetch(&backend->outstanding, 1);
+		int backendSocket = ConnectBackend(backend, HEALTH_TIMEOUT);
+		if (backendSocket >= 0 && Handshake(backendSocket, buffer, HEALTH_TIMEOUT) == 1) {
+			MarkSuccess(backend);
+			__sync_add_and_fetch(&backend->served, 1);
+			if (SendAll(clientSocket, daemonName, strlen(daemonName)) == 1) {
+				Relay(clientSocket, backendSocket);
+			}
+			close(backendSocket);
+			__sync_sub_and_fetch(&backend->outstanding, 1);
+			close(clientSocket);
+			return;
+		}
+		//nothing has reached the client yet, so another backend can take the job
+		if (backendSocket >= 0) close(backendSocket);
+		__sync_sub_and_fetch(&backend->outstanding, 1);
+		MarkFailure(backend);
+	}
+
+	fprintf(stderr, "LB: no backend accepted the job\n");
+	SendAll(clientSocket, "no", 2);
+	close(clientSocket);
+}
+
+/*********************************************************************
+** Description: Copies bytes both ways between client and backend until
+**		both sides have finished sending or neither has sent anything
+**		for RELAY_IDLE_TIMEOUT
+*********************************************************************/
+void Relay(int clientSocket, int backendSocket) {
+	char* buffer = malloc(RELAY_BUFFER);
+	if (buffer == NULL) error("LB: unable to allocate relay buffer");
+	struct pollfd relayPoll[2] = { { clientSocket, POLLIN, 0 }, { backendSocket, POLLIN, 0 } };
+	int peer[2] = { backendSocket, clientSocket };
+	int open = 2;
+
+	while (open > 0) {
+		int ready = poll(relayPoll, 2, RELAY_IDLE_TIMEOUT);
+		if (ready < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (ready == 0) {
+			fprintf(stderr, "LB: relay idle for %d ms, dropping it\n", RELAY_IDLE_TIMEOUT);
+			break;
+		}
+		for (int i = 0; i < 2; i++) {
+			if (relayPoll[i].fd < 0 || relayPoll[i].revents == 0) continue;
+			int charsRead = recv(relayPoll[i].fd, buffer, RELAY_BUFFER, 0);
+			if (charsRead <= 0 || SendAll(peer[i], buffer, charsRead) != 1) {
+				//this side is done, pass the end of stream along
+				shutdown(peer[i], SHUT_WR);
+				relayPoll[i].fd = -1;
+				open--;
+				if (charsRead < 0 || i == 1) open = 0; // the backend's reply is complete once it closes
+			}
+		}
+	}
+	free(buffer);
+}
@@ -0,0 +1,144 @@
+/*********************************************************************
+** Program: otp_net.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Socket helpers shared by the otp clients and daemons
+*********************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "otp_net.h"
+
+//per thread, so a threaded server can give each connection its own limits
+static __thread int idleTimeoutMs; // longest wait for a single read or write, 0 for no limit
+static __thread long long deadlineMs; // MonotonicMs after which all socket waits fail, 0 for none
+static __thread int lastTimeout; // why the last wait gave up, OTP_TIMEOUT_IDLE or OTP_TIMEOUT_DEADLINE
+
+/*********************************************************************
+** Description: Limits how long the helpers below wait on a socket,
+**		which must then be non-blocking; 0 turns a limit off
+*********************************************************************/
+void SetSocketDeadlines(int idleTimeout, long long deadline) {
+	idleTimeoutMs = idleTimeout;
+	deadlineMs = deadline;
+}
+
+/*********************************************************************
+** Description: Returns OTP_TIMEOUT_IDLE or OTP_TIMEOUT_DEADLINE for the
+**		last wait that failed with ETIMEDOUT
+*********************************************************************/
+int LastTimeout() {
+	return lastTimeout;
+}
+
+/*********************************************************************
+** Description: Returns milliseconds on a clock that never jumps
+*********************************************************************/
+long long MonotonicMs() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/*********************************************************************
+** Description: Waits until the socket is ready for events, returns 1,
+**		or 0 with errno set to ETIMEDOUT once a limit is hit
+*********************************************************************/
+static int WaitForSocket(int socketFD, short events) {
+	while (1) {
+		int timeout = idleTimeoutMs > 0 ? idleTimeoutMs : -1;
+		int cause = OTP_TIMEOUT_IDLE;
+		if (deadlineMs > 0) {
+			long long remaining = deadlineMs - MonotonicMs();
+			if (remaining < 0) remaining = 0;
+			if (timeout < 0 || remaining < timeout) {
+				timeout = remaining;
+				cause = OTP_TIMEOUT_DEADLINE;
+			}
+		}
+		struct pollfd socketPoll = { socketFD, events, 0 };
+		int ready = poll(&socketPoll, 1, timeout);
+		if (ready > 0) return 1;
+		if (ready == 0) {
+			lastTimeout = cause;
+			errno = ETIMEDOUT;
+			return 0;
+		}
+		if (errno != EINTR) return 0;
+	}
+}
+
+/*********************************************************************
+** Description: Finds " name=value" after the leading word of a
+**		protocol message and copies value out, returns 1 if it
+**		was present
+*********************************************************************/
+int GetAttribute(const char* message, const char* name, char* value, size_t valueSize) {
+	size_t nameLength = strlen(name);
+	const char* cur = strchr(message, ' ');
+
+	while (cur != NULL) {
+		cur++;
+		if (strncmp(cur, name, nameLength) == 0 && cur[nameLength] == '=') {
+			const char* start = cur + nameLength + 1;
+			size_t length = strcspn(start, " \n");
+			if (length >= valueSize) return 0;
+			memcpy(value, start, length);
+			value[length] = '\0';
+			return 1;
+		}
+		cur = strchr(cur, ' ');
+	}
+	return 0;
+}
+
+/*********************************************************************
+** Description: Sends every byte of data, returns 1 on success
+*********************************************************************/
+int SendAll(int socketFD, const char* data, size_t length) {
+	size_t curChar = 0;
+	while (curChar < length) {
+		long charsWritten = send(socketFD, data + curChar, length - curChar, 0);
+		if (charsWritten < 0) {
+			if (errno == EINTR) continue;
+			if ((errno == EAGAIN || errno == EWOULDBLOCK) && WaitForSocket(socketFD, POLLOUT) == 1) continue;
+			return 0;
+		}
+		curChar += charsWritten;
+	}
+	return 1;
+}
+
+/*********************************************************************
+** Description: Receives exactly length bytes unless the peer stops
+**		sending first, returns the number of bytes received or -1
+*********************************************************************/
+long RecvAll(int socketFD, char* buffer, size_t length) {
+	size_t curChar = 0;
+	while (curChar < length) {
+		long charsRead = RecvSome(socketFD, buffer + curChar, length - curChar);
+		if (charsRead < 0) return -1;
+		if (charsRead == 0) break;
+		curChar += charsRead;
+	}
+	return curChar;
+}
+
+/*********************************************************************
+** Description: Receives whatever is available, up to length bytes,
+**		waiting within the socket's limits; returns the number of
+**		bytes received, 0 at end of stream or -1
+*********************************************************************/
+long RecvSome(int socketFD, char* buffer, size_t length) {
+	while (1) {
+		long charsRead = recv(socketFD, buffer, length, 0);
+		if (charsRead >= 0) return charsRead;
+		if (errno == EINTR) continue;
+		if ((errno == EAGAIN || errno == EWOULDBLOCK) && WaitForSocket(socketFD, POLLIN) == 1) continue;
+		return -1;
+	}
+}
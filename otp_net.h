@@ -0,0 +1,23 @@
+/*********************************************************************
+** Program: otp_net.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Socket helpers shared by the otp clients and daemons
+*********************************************************************/
+#ifndef OTP_NET_H
+#define OTP_NET_H
+
+#include <stddef.h>
+
+#define OTP_TIMEOUT_IDLE 1 // the peer went quiet for longer than the idle timeout
+#define OTP_TIMEOUT_DEADLINE 2 // the connection's deadline passed
+
+int SendAll(int socketFD, const char* data, size_t length);
+long RecvAll(int socketFD, char* buffer, size_t length);
+long RecvSome(int socketFD, char* buffer, size_t length);
+void SetSocketDeadlines(int idleTimeout, long long deadline);
+int LastTimeout();
+long long MonotonicMs();
+int GetAttribute(const char* message, const char* name, char* value, size_t valueSize);
+
+#endif
@@ -0,0 +1,77 @@
+/*********************************************************************
+** Program: otp_parallel.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Splits a large text into cache-sized blocks and runs a
+**		per-block transform across several threads
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "otp_parallel.h"
+
+// Work shared by every thread taking part in one transform
+struct BlockQueue {
+	char* text;
+	const char* key;
+	size_t length;
+	size_t numBlocks;
+	volatile size_t nextBlock; // next block nobody has claimed yet
+	BlockTransform transform;
+	const void* context; // passed through to transform
+};
+
+/*********************************************************************
+** Description: Claims blocks one at a time until none are left, so a
+**		thread that finishes early keeps taking work from the rest
+*********************************************************************/
+static void* TransformBlocks(void* arg) {
+	struct BlockQueue* queue = arg;
+	size_t block;
+
+	while ((block = __sync_fetch_and_add(&queue->nextBlock, 1)) < queue->numBlocks) {
+		size_t start = block * OTP_BLOCK_SIZE;
+		size_t end = start + OTP_BLOCK_SIZE;
+		if (end > queue->length) end = queue->length;
+		queue->transform(queue->context, queue->text, queue->key, start, end);
+	}
+	return NULL;
+}
+
+/*********************************************************************
+** Description: Transforms text[0, length) in place, on the calling
+**		thread when the text is under threshold and across
+**		numThreads threads otherwise
+*********************************************************************/
+void ParallelTransform(char* text, const char* key, size_t length, BlockTransform transform, const void* context, int numThreads, size_t threshold) {
+	struct BlockQueue queue = { text, key, length, (length + OTP_BLOCK_SIZE - 1) / OTP_BLOCK_SIZE, 0, transform, context };
+
+	if (length < threshold || numThreads <= 1 || queue.numBlocks <= 1) {
+		transform(context, text, key, 0, length);
+		return;
+	}
+	if (numThreads > queue.numBlocks) numThreads = queue.numBlocks;
+
+	//the calling thread works too, so start one fewer helper
+	pthread_t* helpers = malloc((numThreads - 1) * sizeof(pthread_t));
+	int numHelpers = 0;
+	if (helpers != NULL) {
+		while (numHelpers < numThreads - 1 && pthread_create(&helpers[numHelpers], NULL, TransformBlocks, &queue) == 0) {
+			numHelpers++;
+		}
+	}
+	TransformBlocks(&queue);
+	for (int i = 0; i < numHelpers; i++) {
+		pthread_join(helpers[i], NULL);
+	}
+	free(helpers);
+}
+
+/*********************************************************************
+** Description: Returns the number of online cores, at least 1
+*********************************************************************/
+int DefaultThreadCount() {
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (int)cores : 1;
+}
@@ -0,0 +1,22 @@
+/*********************************************************************
+** Program: otp_parallel.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Splits a large text into cache-sized blocks and runs a
+**		per-block transform across several threads
+*********************************************************************/
+#ifndef OTP_PARALLEL_H
+#define OTP_PARALLEL_H
+
+#include <stddef.h>
+
+#define OTP_BLOCK_SIZE 65536 // bytes handed to a thread at a time, sized to stay in L2
+#define OTP_DEFAULT_PARALLEL_THRESHOLD (1 << 20) // texts shorter than this stay single threaded
+
+// Transforms text[start, end) in place using the matching key bytes
+typedef void (*BlockTransform)(const void* context, char* text, const char* key, size_t start, size_t end);
+
+void ParallelTransform(char* text, const char* key, size_t length, BlockTransform transform, const void* context, int numThreads, size_t threshold);
+int DefaultThreadCount();
+
+#endif
@@ -0,0 +1,142 @@
+/*********************************************************************
+** Program: otp_pool.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Size-classed text and key buffers shared by a daemon and
+**		the children it forks, recycled from job to job
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "otp_pool.h"
+
+#define POOL_CLASSES 3
+#define POOL_MAX_BUFFERS 64 // across every class
+#define POOL_LARGE_CLASS (POOL_CLASSES - 1)
+
+// One size of buffer; its buffers sit back to back from base
+struct PoolClass {
+	size_t size;
+	int count;
+	int first; // index of its first buffer in owners
+	char* base;
+	int hugePages; // base is backed by huge pages
+	long hits;
+};
+
+// Lives in memory every child shares, so a buffer taken in one child is
+// seen as taken by the rest
+struct PoolState {
+	struct PoolClass classes[POOL_CLASSES];
+	pid_t owners[POOL_MAX_BUFFERS]; // process holding each buffer, 0 when free
+	long misses; // requests the pool could not serve
+};
+
+static struct PoolState* pool; // NULL until PoolInit, when every request falls back to malloc
+
+static const size_t classSizes[POOL_CLASSES] = { 1 << 16, 1 << 20, 1 << 24 };
+static const int classCounts[POOL_CLASSES] = { 16, 10, OTP_POOL_DEFAULT_LARGE }; // two per connection for the small classes
+
+/*********************************************************************
+** Description: Maps and pre-faults every buffer up front so jobs never
+**		pay for page faults or zeroing; the largest class may use
+**		huge pages, falling back to normal pages when none are free
+*********************************************************************/
+void PoolInit(int largeBuffers, int hugePages) {
+	pool = mmap(NULL, sizeof(struct PoolState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (pool == MAP_FAILED) { perror("SERVER: ERROR mapping buffer pool"); exit(1); }
+
+	int first = 0;
+	for (int i = 0; i < POOL_CLASSES; i++) {
+		struct PoolClass* sizeClass = &pool->classes[i];
+		sizeClass->size = classSizes[i];
+		sizeClass->count = i == POOL_LARGE_CLASS ? largeBuffers : classCounts[i];
+		if (first + sizeClass->count > POOL_MAX_BUFFERS) sizeClass->count = POOL_MAX_BUFFERS - first;
+		sizeClass->first = first;
+		first += sizeClass->count;
+		if (sizeClass->count <= 0) continue;
+
+		size_t length = sizeClass->size * sizeClass->count;
+		sizeClass->base = MAP_FAILED;
+		if (hugePages && i == POOL_LARGE_CLASS) {
+			sizeClass->base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+			if (sizeClass->base == MAP_FAILED) fprintf(stderr, "SERVER: no huge pages for the buffer pool, using normal pages\n");
+			else sizeClass->hugePages = 1;
+		}
+		if (sizeClass->base == MAP_FAILED)
+			sizeClass->base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		if (sizeClass->base == MAP_FAILED) { perror("SERVER: ERROR mapping buffer pool"); exit(1); }
+	}
+}
+
+/*********************************************************************
+** Description: Returns a buffer of at least size bytes from the
+**		smallest class with one free, or from malloc when none is;
+**		its contents are whatever the last job left there
+*********************************************************************/
+char* PoolAlloc(size_t size) {
+	if (pool != NULL) {
+		pid_t self = getpid();
+		for (int i = 0; i < POOL_CLASSES; i++) {
+			struct PoolClass* sizeClass = &pool->classes[i];
+			if (sizeClass->size < size) continue;
+			for (int j = 0; j < sizeClass->count; j++) {
+				if (__sync_bool_compare_and_swap(&pool->owners[sizeClass->first + j], 0, self)) {
+					__sync_fetch_and_add(&sizeClass->hits, 1);
+					return sizeClass->base + j * sizeClass->size;
+				}
+			}
+		}
+		__sync_fetch_and_add(&pool->misses, 1);
+	}
+	return malloc(size);
+}
+
+/*********************************************************************
+** Description: Returns a buffer from PoolAlloc to wherever it came from
+*********************************************************************/
+void PoolFree(char* buffer) {
+	if (pool != NULL) {
+		for (int i = 0; i < POOL_CLASSES; i++) {
+			struct PoolClass* sizeClass = &pool->classes[i];
+			if (sizeClass->count > 0 && buffer >= sizeClass->base && buffer < sizeClass->base + sizeClass->size * sizeClass->count) {
+				pool->owners[sizeClass->first + (buffer - sizeClass->base) / sizeClass->size] = 0;
+				return;
+			}
+		}
+	}
+	free(buffer);
+}
+
+/*********************************************************************
+** Description: Frees every buffer still held by owner, a child that
+**		exited or was killed without returning them
+*********************************************************************/
+void PoolReleaseOwner(pid_t owner) {
+	if (pool == NULL) return;
+	for (int i = 0; i < POOL_MAX_BUFFERS; i++) {
+		if (pool->owners[i] == owner) pool->owners[i] = 0;
+	}
+}
+
+/*********************************************************************
+** Description: Prints hits per class, misses and buffers in use as
+**		name value lines
+*********************************************************************/
+void PoolDumpStats(FILE* out) {
+	if (pool == NULL) return;
+	for (int i = 0; i < POOL_CLASSES; i++) {
+		struct PoolClass* sizeClass = &pool->classes[i];
+		int inUse = 0;
+		for (int j = 0; j < sizeClass->count; j++) {
+			if (pool->owners[sizeClass->first + j] != 0) inUse++;
+		}
+		fprintf(out, "pool_%zuk_buffers %d\n", sizeClass->size >> 10, sizeClass->count);
+		fprintf(out, "pool_%zuk_in_use %d\n", sizeClass->size >> 10, inUse);
+		fprintf(out, "pool_%zuk_hits %ld\n", sizeClass->size >> 10, sizeClass->hits);
+		if (sizeClass->hugePages) fprintf(out, "pool_%zuk_huge_pages 1\n", sizeClass->size >> 10);
+	}
+	fprintf(out, "pool_misses %ld\n", pool->misses);
+}
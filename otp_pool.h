@@ -0,0 +1,23 @@
+/*********************************************************************
+** Program: otp_pool.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Size-classed text and key buffers shared by a daemon and
+**		the children it forks, recycled from job to job
+*********************************************************************/
+#ifndef OTP_POOL_H
+#define OTP_POOL_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define OTP_POOL_DEFAULT_LARGE 2 // buffers in the largest size class
+
+void PoolInit(int largeBuffers, int hugePages);
+char* PoolAlloc(size_t size);
+void PoolFree(char* buffer);
+void PoolReleaseOwner(pid_t owner);
+void PoolDumpStats(FILE* out);
+
+#endif
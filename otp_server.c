@@ -0,0 +1,1064 @@
+/*********************************************************************
+** Program: otp_server.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Presents 5 sockets through which processes may connect
+**		and request encryption or decryption of a text using a
+**		cipher text; shared by otp_enc_d and otp_dec_d
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include "otp_server.h"
+#include "otp_net.h"
+#include "otp_trace.h"
+#include "otp_codec.h"
+#include "otp_pool.h"
+#include "otp_tenant.h"
+#include "otp_store.h"
+
+#define MAX_CHILDREN 5 // connections served at once
+#define DEFAULT_DRAIN_TIMEOUT 30 // seconds running jobs get to finish after a handoff
+#define HANDOFF_TIMEOUT 10 // seconds a successor gets to confirm it is accepting
+#define DEFAULT_HANDSHAKE_TIMEOUT 10000 // ms a client gets to identify itself
+#define DEFAULT_IDLE_TIMEOUT 60000 // ms a client may go without sending or receiving
+#define DEADLINE_GRACE 1000 // ms past its deadline before the parent kills a child
+#define WHEEL_SLOTS 64 // buckets in the deadline timer wheel
+#define WHEEL_TICK 100 // ms covered by one bucket
+#define MAX_PENDING 32 // accepted connections waiting for a slot
+#define TENANT_QUEUE_LIMIT 8 // waiting connections one tenant may have before more are turned away
+#define DEFAULT_MEMORY_BUDGET (1LL << 30) // bytes all running jobs may hold at once
+#define DEFAULT_BUDGET_WAIT 2000 // ms a job waits for budget before the client is told to retry
+#define BUDGET_RETRY_HINT 500 // ms a busy client is asked to wait before retrying
+#define STORE_SWEEP_INTERVAL 60000 // ms between sweeps of expired async results
+#define FETCH_CHUNK 65536 // bytes of a stored result read and sent at a time
+#define STREAM_MAX_CHUNK (1 << 20) // largest frame a stream may ask for
+#define FRAME_HEADER 10 // digits of the length that starts each stream frame
+
+//counters shared by the parent and its children, dumped on SIGUSR1
+struct ServerStats {
+	long jobs; // requests answered
+	long handshakeTimeouts; // clients that never identified themselves
+	long idleTimeouts; // clients that went quiet mid request
+	long requestTimeouts; // requests that outlived --request-timeout
+	long deadlineKills; // children the parent killed past their deadline
+	long tenantRejects; // connections closed because their tenant had too many waiting
+	long busyReplies; // jobs told to retry because the memory budget was spent
+	long tooLarge; // jobs larger than the whole memory budget
+	long long memoryReserved; // bytes reserved by running jobs
+	long long slotReserved[MAX_CHILDREN]; // bytes each child has reserved
+	long long slotDeadline[MAX_CHILDREN]; // MonotonicMs each child must finish by, 0 for none
+	char slotTicket[MAX_CHILDREN][OTP_TICKET_SIZE]; // async job each child has room in the store for, "" for none
+};
+
+//prototypes
+int Handshake(struct DaemonMode* mode, int childSocket);
+void ProcessMsg(struct DaemonMode* mode, int childSocket);
+static int OpenListener(int portNumber);
+static int OpenControl(const char* path);
+static int TakeOver(const char* path, int* listenSocketFD);
+static int HandOff(int controlSocketFD, int listenSocketFD);
+static void Drain(struct DaemonMode* mode, int drainTimeout);
+static void AcceptPending(int listenSocketFD);
+static void IdentifyPending(int index, short revents);
+static void ExpirePending(long long now);
+static void RemovePending(int index);
+static void DropPending(int index);
+static void Dispatch(struct DaemonMode* mode, int listenSocketFD, int controlSocketFD, int force);
+static void ReapChildren();
+static void NoteChildExit(int signalNumber);
+static void NoteDumpRequest(int signalNumber);
+static void DumpStats();
+static void ServeConnection(struct DaemonMode* mode, int childSocket, int slot, long long startTime);
+static void CountTimeout();
+static void WheelInsert(int slot, long long expiry);
+static void WheelRemove(int slot);
+static void WheelAdvance(long long now);
+static int ReserveMemory(long long bytes);
+static void ReleaseMemory(int slot);
+static void FetchResult(int childSocket, const char* request);
+static void StreamMsg(struct DaemonMode* mode, int childSocket, const char* request, const struct OtpAlphabet* alphabet);
+
+static void error(const char *msg) { if (errno == ETIMEDOUT) CountTimeout(); perror(msg); exit(1); } // Error function used for reporting issues
+
+static int numThreads; // threads a single large job may use, see --threads
+static size_t parallelThreshold; // smallest job split across threads, see --parallel-threshold
+static const struct OtpAlphabet* defaultAlphabet; // used when a job doesn't name one, see --alphabet
+static int handshakeTimeout = DEFAULT_HANDSHAKE_TIMEOUT; // see --handshake-timeout
+static int idleTimeout = DEFAULT_IDLE_TIMEOUT; // see --idle-timeout
+static int requestTimeout; // ms a whole request may take, 0 for no limit, see --request-timeout
+static int inHandshake; // child only; classifies a timeout for the counters
+static struct ServerStats* stats;
+static volatile sig_atomic_t dumpRequested;
+static pid_t childProcs[MAX_CHILDREN]; // child serving each slot, 0 when the slot is free
+static int childTenants[MAX_CHILDREN]; // tenant each slot is serving
+static int numChildProcs;
+static int currentTenant = -1; // child only; tenant charged for the bytes of this request
+static int currentSlot = -1; // child only; where its memory reservation is recorded
+static long long memoryBudget = DEFAULT_MEMORY_BUDGET; // see --memory-budget
+static int budgetWait = DEFAULT_BUDGET_WAIT; // see --budget-wait
+
+//accepted connections, oldest first, waiting to be identified and handed a slot
+struct Pending {
+	int socketFD;
+	int tenant; // -1 until the client's first message has been seen
+	long long acceptTime;
+	char peer[INET_ADDRSTRLEN]; // the tenant for clients that don't name one
+};
+static struct Pending pending[MAX_PENDING];
+static int numPending;
+
+//hashed timer wheel of child deadlines; each slot has at most one timer
+static int wheel[WHEEL_SLOTS]; // first slot in each bucket, -1 when empty
+static int wheelNext[MAX_CHILDREN]; // next slot in the same bucket
+static int wheelBucket[MAX_CHILDREN]; // bucket holding the slot's timer, -1 when not armed
+static long long wheelExpiry[MAX_CHILDREN];
+static long long wheelTick; // last tick processed
+static int numTimers;
+
+/*********************************************************************
+** Description: Manages sockets and forked child processes, each of which
+**		can receive and process a request; hands the listening socket
+**		to a successor and drains when one takes over
+*********************************************************************/
+int RunDaemon(struct DaemonMode* mode, int argc, char *argv[]) {
+	int listenSocketFD, controlSocketFD = -1;
+	char* controlPath = NULL; // where successors ask for the listening socket, see --control
+	char* takeoverPath = NULL; // predecessor to take the listening socket from, see --takeover
+	int drainTimeout = DEFAULT_DRAIN_TIMEOUT;
+	int poolLarge = OTP_POOL_DEFAULT_LARGE; // see --pool-large
+	int hugePages = 0; // see --huge-pages
+	char resultDir[256]; // see --result-dir
+	int resultTtl = OTP_DEFAULT_RESULT_TTL; // see --result-ttl
+	long long resultStoreMax = OTP_DEFAULT_RESULT_STORE_MAX; // see --result-store-max
+	double tenantRate = 0, tenantByteRate = 0; // see --tenant-rate and --tenant-byte-rate
+
+	static struct option longOptions[] = {
+		{ "threads", required_argument, NULL, 't' },
+		{ "parallel-threshold", required_argument, NULL, 'p' },
+		{ "alphabet", required_argument, NULL, 'a' },
+		{ "control", required_argument, NULL, 'c' },
+		{ "takeover", required_argument, NULL, 'T' },
+		{ "drain-timeout", required_argument, NULL, 'd' },
+		{ "trace", required_argument, NULL, 'r' },
+		{ "handshake-timeout", required_argument, NULL, 'H' },
+		{ "idle-timeout", required_argument, NULL, 'I' },
+		{ "request-timeout", required_argument, NULL, 'R' },
+		{ "pool-large", required_argument, NULL, 'P' },
+		{ "huge-pages", no_argument, NULL, 'g' },
+		{ "tenant-rate", required_argument, NULL, 'j' },
+		{ "tenant-byte-rate", required_argument, NULL, 'b' },
+		{ "tenant-weight", required_argument, NULL, 'w' },
+		{ "memory-budget", required_argument, NULL, 'm' },
+		{ "budget-wait", required_argument, NULL, 'W' },
+		{ "result-dir", required_argument, NULL, 'D' },
+		{ "result-ttl", required_argument, NULL, 'L' },
+		{ "result-store-max", required_argument, NULL, 'S' },
+		{ NULL, 0, NULL, 0 }
+	};
+	numThreads = DefaultThreadCount();
+	TenantInit(); // weights are set while parsing
+	parallelThreshold = OTP_DEFAULT_PARALLEL_THRESHOLD;
+	defaultAlphabet = OtpCodecFindAlphabet(OTP_DEFAULT_ALPHABET);
+	snprintf(resultDir, sizeof(resultDir), "/dev/shm/%s.results", mode->progName);
+	int option;
+	while ((option = getopt_long(argc, argv, "t:p:a:c:T:d:r:H:I:R:P:gj:b:w:m:W:D:L:S:", longOptions, NULL)) != -1) {
+		switch (option) {
+		case 't':
+			numThreads = atoi(optarg);
+			break;
+		case 'p':
+			parallelThreshold = strtoul(optarg, NULL, 10);
+			break;
+		case 'a':
+			defaultAlphabet = OtpCodecFindAlphabet(optarg);
+			if (defaultAlphabet == NULL) { fprintf(stderr, "SERVER: unknown alphabet %s\n", optarg); exit(1); }
+			break;
+		case 'c':
+			controlPath = optarg;
+			break;
+		case 'T':
+			takeoverPath = optarg;
+			break;
+		case 'd':
+			drainTimeout = atoi(optarg);
+			break;
+		case 'r':
+			TraceOpen(optarg, mode->progName);
+			break;
+		case 'H':
+			handshakeTimeout = atoi(optarg);
+			break;
+		case 'I':
+			idleTimeout = atoi(optarg);
+			break;
+		case 'R':
+			requestTimeout = atoi(optarg);
+			break;
+		case 'P':
+			poolLarge = atoi(optarg);
+			break;
+		case 'g':
+			hugePages = 1;
+			break;
+		case 'j':
+			tenantRate = atof(optarg);
+			break;
+		case 'b':
+			tenantByteRate = atof(optarg);
+			break;
+		case 'w':
+			if (TenantSetWeight(optarg) != 1) { fprintf(stderr, "SERVER: bad tenant weight %s, expected name=weight\n", optarg); exit(1); }
+			break;
+		case 'm':
+			memoryBudget = strtoll(optarg, NULL, 10);
+			if (memoryBudget <= 0) { fprintf(stderr, "SERVER: memory budget must be positive\n"); exit(1); }
+			break;
+		case 'W':
+			budgetWait = atoi(optarg);
+			break;
+		case 'D':
+			snprintf(resultDir, sizeof(resultDir), "%s", optarg);
+			break;
+		case 'L':
+			resultTtl = atoi(optarg);
+			break;
+		case 'S':
+			resultStoreMax = strtoll(optarg, NULL, 10);
+			break;
+		default:
+			exit(1);
+		}
+	}
+
+	if (optind >= argc) { fprintf(stderr, "SERVER: USAGE: %s [--threads n] [--parallel-threshold bytes] [--alphabet name] [--control path] [--takeover path] [--drain-timeout seconds] [--trace file] [--handshake-timeout ms] [--idle-timeout ms] [--request-timeout ms] [--pool-large n] [--huge-pages] [--tenant-rate jobs] [--tenant-byte-rate bytes] [--tenant-weight name=weight] [--memory-budget bytes] [--budget-wait ms] [--result-dir path] [--result-ttl seconds] [--result-store-max bytes] port\n", argv[0]); exit(1); } // Check usage & args
+
+	// Take over a running daemon's socket, or bind a fresh one
+	int predecessorFD = -1;
+	if (takeoverPath != NULL) {
+		predecessorFD = TakeOver(takeoverPath, &listenSocketFD);
+	}
+	else {
+		listenSocketFD = OpenListener(atoi(argv[optind]));
+	}
+	if (controlPath != NULL) controlSocketFD = OpenControl(controlPath);
+	TenantSetRates(tenantRate, tenantByteRate);
+
+	stats = mmap(NULL, sizeof(struct ServerStats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) error("SERVER: ERROR mapping shared counters");
+	PoolInit(poolLarge, hugePages);
+	StoreInit(resultDir, resultTtl, resultStoreMax);
+	long long lastSweep = 0;
+	for (int i = 0; i < WHEEL_SLOTS; i++) wheel[i] = -1;
+	for (int i = 0; i < MAX_CHILDREN; i++) wheelBucket[i] = -1;
+	wheelTick = MonotonicMs() / WHEEL_TICK;
+
+	// A finished child interrupts poll so its slot is reclaimed promptly
+	struct sigaction childAction;
+	memset(&childAction, 0, sizeof(childAction));
+	childAction.sa_handler = NoteChildExit;
+	sigaction(SIGCHLD, &childAction, NULL);
+	childAction.sa_handler = NoteDumpRequest;
+	sigaction(SIGUSR1, &childAction, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// Only now is it safe for the predecessor to stop accepting
+	if (predecessorFD >= 0) {
+		SendAll(predecessorFD, "ok", 2);
+		close(predecessorFD);
+	}
+
+	while (1) {
+		ReapChildren();
+		long long now = MonotonicMs();
+		WheelAdvance(now);
+		ExpirePending(now);
+		Dispatch(mode, listenSocketFD, controlSocketFD, 0);
+		if (dumpRequested) DumpStats();
+		if (now - lastSweep >= STORE_SWEEP_INTERVAL) {
+			StoreSweep();
+			lastSweep = now;
+		}
+
+		//wait for a client, a waiting client's first message, or a successor on the control socket
+		struct pollfd waitPoll[2 + MAX_PENDING] = { { listenSocketFD, POLLIN, 0 }, { controlSocketFD, POLLIN, 0 } };
+		if (numPending >= MAX_PENDING) waitPoll[0].events = 0; // the queue is full, later clients wait in the backlog
+		for (int i = 0; i < numPending; i++) {
+			waitPoll[2 + i].fd = pending[i].socketFD;
+			waitPoll[2 + i].events = pending[i].tenant < 0 ? POLLIN : 0;
+		}
+		//wake each tick while deadlines or tenant buckets may change what can run
+		int waitTime = numTimers > 0 || numPending > 0 || numChildProcs >= MAX_CHILDREN ? WHEEL_TICK - now % WHEEL_TICK : STORE_SWEEP_INTERVAL;
+		int numPolled = 2 + numPending;
+		if (poll(waitPoll, numPolled, waitTime) < 0) {
+			if (errno == EINTR) continue;
+			error("SERVER: ERROR polling sockets");
+		}
+
+		if (waitPoll[1].revents & POLLIN) {
+			if (HandOff(controlSocketFD, listenSocketFD) == 1) break;
+		}
+		for (int i = numPolled - 3; i >= 0; i--) { // newest first, so removals don't shift the rest
+			if (waitPoll[2 + i].revents != 0) IdentifyPending(i, waitPoll[2 + i].revents);
+		}
+		if (waitPoll[0].revents & POLLIN) AcceptPending(listenSocketFD);
+	}
+
+	// A successor owns the socket now; stop accepting and let running jobs finish
+	close(listenSocketFD); // Close the listening socket
+	close(controlSocketFD);
+	Drain(mode, drainTimeout);
+
+	return 0;
+}
+
+/*********************************************************************
+** Description: Accepts a connection into the queue of those waiting
+**		for a slot
+*********************************************************************/
+static void AcceptPending(int listenSocketFD) {
+	struct sockaddr_in clientAddress;
+	socklen_t sizeOfClientInfo = sizeof(clientAddress); // Get the size of the address for the client that will connect
+	int connectedSocketFD = accept(listenSocketFD, (struct sockaddr *)&clientAddress, &sizeOfClientInfo); // Accept
+	if (connectedSocketFD < 0) {
+		if (errno == EINTR || errno == EAGAIN || errno == ECONNABORTED) return;
+		error("SERVER: ERROR on accept");
+	}
+
+	struct Pending* waiting = &pending[numPending++];
+	waiting->socketFD = connectedSocketFD;
+	waiting->tenant = -1;
+	waiting->acceptTime = MonotonicMs();
+	inet_ntop(AF_INET, &clientAddress.sin_addr, waiting->peer, sizeof(waiting->peer));
+}
+
+/*********************************************************************
+** Description: Peeks at a waiting client's handshake, leaving it for the
+**		child, to learn its tenant; turns the client away if its
+**		tenant already has too many connections waiting. A client
+**		already identified is only dropped if its socket died
+*********************************************************************/
+static void IdentifyPending(int index, short revents) {
+	struct Pending* waiting = &pending[index];
+	if (waiting->tenant >= 0) {
+		if (revents & (POLLHUP | POLLERR)) DropPending(index);
+		return;
+	}
+	char hello[256];
+	long charsRead = recv(waiting->socketFD, hello, sizeof(hello) - 1, MSG_PEEK | MSG_DONTWAIT);
+	if (charsRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+	if (charsRead <= 0) { // gone before it was served
+		DropPending(index);
+		return;
+	}
+	hello[charsRead] = '\0';
+
+	char tenantName[OTP_TENANT_NAME_SIZE];
+	if (GetAttribute(hello, "tenant", tenantName, sizeof(tenantName)) != 1) strcpy(tenantName, waiting->peer);
+	int tenant = FindTenant(tenantName);
+	if (TenantAt(tenant)->queued >= TENANT_QUEUE_LIMIT) {
+		TenantAt(tenant)->rejected++;
+		__sync_fetch_and_add(&stats->tenantRejects, 1);
+		DropPending(index);
+		return;
+	}
+	TenantAt(tenant)->queued++;
+	waiting->tenant = tenant;
+}
+
+/*********************************************************************
+** Description: Closes waiting clients that have not said who they are
+**		within the handshake timeout
+*********************************************************************/
+static void ExpirePending(long long now) {
+	for (int i = numPending - 1; i >= 0; i--) {
+		if (pending[i].tenant < 0 && now - pending[i].acceptTime > handshakeTimeout) {
+			DropPending(i);
+			__sync_fetch_and_add(&stats->handshakeTimeouts, 1);
+		}
+	}
+}
+
+/*********************************************************************
+** Description: Drops a connection from the queue, keeping the rest in
+**		the order they arrived
+*********************************************************************/
+static void RemovePending(int index) {
+	numPending--;
+	memmove(&pending[index], &pending[index + 1], (numPending - index) * sizeof(struct Pending));
+}
+
+/*********************************************************************
+** Description: Closes a connection that will never be served and drops
+**		it from the queue, and from its tenant's count if it had one
+*********************************************************************/
+static void DropPending(int index) {
+	if (pending[index].tenant >= 0) TenantAt(pending[index].tenant)->queued--;
+	close(pending[index].socketFD);
+	RemovePending(index);
+}
+
+/*********************************************************************
+** Description: Hands waiting connections to children while slots are
+**		free, always choosing the tenant with the lowest fair queuing
+**		tag whose buckets allow another job; force ignores the buckets
+**		and serves clients that never named a tenant by address
+*********************************************************************/
+static void Dispatch(struct DaemonMode* mode, int listenSocketFD, int controlSocketFD, int force) {
+	long long now = MonotonicMs();
+	while (numChildProcs < MAX_CHILDREN) {
+		int best = -1;
+		double bestStart = 0;
+		for (int i = 0; i < numPending; i++) {
+			if (pending[i].tenant < 0) {
+				if (!force) continue;
+				pending[i].tenant = FindTenant(pending[i].peer);
+				TenantAt(pending[i].tenant)->queued++;
+			}
+			if (!force && TenantReady(pending[i].tenant, now) != 1) continue;
+			double start = TenantStart(pending[i].tenant);
+			if (best < 0 || start < bestStart) { // a tenant's own connections keep their order
+				best = i;
+				bestStart = start;
+			}
+		}
+		if (best < 0) return;
+
+		struct Pending chosen = pending[best];
+		RemovePending(best);
+		TenantDispatched(chosen.tenant);
+
+		//the connection's first deadline is the end of its handshake, counted from when it gets a slot
+		int slot = 0;
+		while (childProcs[slot] != 0) slot++;
+		long long deadline = now + handshakeTimeout;
+		if (requestTimeout > 0 && now + requestTimeout < deadline) deadline = now + requestTimeout;
+		stats->slotDeadline[slot] = deadline;
+
+		pid_t spawnPid = fork();
+		switch (spawnPid) {
+		case 0://this is the child process
+			if (listenSocketFD >= 0) close(listenSocketFD);
+			if (controlSocketFD >= 0) close(controlSocketFD);
+			for (int i = 0; i < numPending; i++) close(pending[i].socketFD);
+			currentTenant = chosen.tenant;
+			currentSlot = slot;
+			ServeConnection(mode, chosen.socketFD, slot, now);
+			exit(0);
+			break;
+		case -1://something has gone terribly wrong
+			error("SERVER: failed to fork: ");
+			break;
+		default://this is the parent process
+			close(chosen.socketFD); // the child owns the connection now
+			childProcs[slot] = spawnPid;
+			childTenants[slot] = chosen.tenant;
+			numChildProcs++;
+			WheelInsert(slot, deadline + DEADLINE_GRACE);
+			break;
+		}
+	}
+}
+
+/*********************************************************************
+** Description: Runs in the child; serves one connection within the
+**		handshake, idle and request deadlines, publishing the current
+**		deadline in the child's slot for the parent to enforce
+*********************************************************************/
+static void ServeConnection(struct DaemonMode* mode, int childSocket, int slot, long long startTime) {
+	long long requestDeadline = requestTimeout > 0 ? startTime + requestTimeout : 0;
+
+	//a stalled client now times out in poll instead of blocking in recv forever
+	fcntl(childSocket, F_SETFL, fcntl(childSocket, F_GETFL) | O_NONBLOCK);
+	SetSocketDeadlines(idleTimeout, stats->slotDeadline[slot]);
+
+	inHandshake = 1;
+	long long handshakeStart = TraceNow();
+	if (Handshake(mode, childSocket) != 1) {
+		char errMsg[100];
+		close(childSocket); // Close the existing socket which is connected to the client
+		sprintf(errMsg, "SERVER: client failed handshake, terminating %s", mode->action);
+		error(errMsg);
+	}
+	TraceSpan("handshake", handshakeStart);
+	inHandshake = 0;
+
+	stats->slotDeadline[slot] = requestDeadline;
+	SetSocketDeadlines(idleTimeout, requestDeadline);
+	ProcessMsg(mode, childSocket);
+	close(childSocket); // Close the existing socket which is connected to the client
+}
+
+/*********************************************************************
+** Description: Counts a connection that ran out of time, by which
+**		deadline it missed
+*********************************************************************/
+static void CountTimeout() {
+	if (stats == NULL) return;
+	if (inHandshake) __sync_fetch_and_add(&stats->handshakeTimeouts, 1);
+	else if (LastTimeout() == OTP_TIMEOUT_IDLE) __sync_fetch_and_add(&stats->idleTimeouts, 1);
+	else __sync_fetch_and_add(&stats->requestTimeouts, 1);
+}
+
+/*********************************************************************
+** Description: Prints the shared counters to stderr as name value lines
+*********************************************************************/
+static void DumpStats() {
+	dumpRequested = 0;
+	fprintf(stderr, "jobs %ld\n", stats->jobs);
+	fprintf(stderr, "handshake_timeouts %ld\n", stats->handshakeTimeouts);
+	fprintf(stderr, "idle_timeouts %ld\n", stats->idleTimeouts);
+	fprintf(stderr, "request_timeouts %ld\n", stats->requestTimeouts);
+	fprintf(stderr, "deadline_kills %ld\n", stats->deadlineKills);
+	fprintf(stderr, "tenant_rejects %ld\n", stats->tenantRejects);
+	fprintf(stderr, "memory_budget %lld\n", memoryBudget);
+	fprintf(stderr, "memory_reserved %lld\n", stats->memoryReserved);
+	fprintf(stderr, "busy_replies %ld\n", stats->busyReplies);
+	fprintf(stderr, "too_large %ld\n", stats->tooLarge);
+	fprintf(stderr, "result_store_bytes %lld\n", StoreUsage());
+	fprintf(stderr, "active_connections %d\n", numChildProcs);
+	fprintf(stderr, "waiting_connections %d\n", numPending);
+	PoolDumpStats(stderr);
+	TenantDumpStats(stderr);
+}
+
+/*********************************************************************
+** Description: Runs in the child; reserves bytes of the memory budget
+**		for this job, waiting up to --budget-wait for other jobs to
+**		release theirs; returns 1 once reserved
+*********************************************************************/
+static int ReserveMemory(long long bytes) {
+	long long giveUp = MonotonicMs() + budgetWait;
+	while (1) {
+		long long reserved = stats->memoryReserved;
+		if (reserved + bytes <= memoryBudget) {
+			if (__sync_bool_compare_and_swap(&stats->memoryReserved, reserved, reserved + bytes)) {
+				stats->slotReserved[currentSlot] = bytes;
+				return 1;
+			}
+			continue; // another child got in first
+		}
+		if (MonotonicMs() >= giveUp) return 0;
+		poll(NULL, 0, 10);
+	}
+}
+
+/*********************************************************************
+** Description: Returns the slot's reservation to the budget; safe to
+**		call from both the child and the parent reaping it
+*********************************************************************/
+static void ReleaseMemory(int slot) {
+	long long bytes = __sync_lock_test_and_set(&stats->slotReserved[slot], 0);
+	if (bytes != 0) __sync_fetch_and_sub(&stats->memoryReserved, bytes);
+}
+
+/*********************************************************************
+** Description: Arms the slot's timer to fire at expiry
+*********************************************************************/
+static void WheelInsert(int slot, long long expiry) {
+	int bucket = ((expiry + WHEEL_TICK - 1) / WHEEL_TICK) % WHEEL_SLOTS; // the first tick at or after expiry
+	wheelExpiry[slot] = expiry;
+	wheelBucket[slot] = bucket;
+	wheelNext[slot] = wheel[bucket];
+	wheel[bucket] = slot;
+	numTimers++;
+}
+
+/*********************************************************************
+** Description: Disarms the slot's timer, if it has one
+*********************************************************************/
+static void WheelRemove(int slot) {
+	if (wheelBucket[slot] < 0) return;
+	int* link = &wheel[wheelBucket[slot]];
+	while (*link != slot) link = &wheelNext[*link];
+	*link = wheelNext[slot];
+	wheelBucket[slot] = -1;
+	numTimers--;
+}
+
+/*********************************************************************
+** Description: Fires the timers due by now; a child whose deadline has
+**		not moved is killed, one that moved it is rescheduled
+*********************************************************************/
+static void WheelAdvance(long long now) {
+	long long nowTick = now / WHEEL_TICK;
+	if (numTimers == 0) wheelTick = nowTick;
+	else if (nowTick - wheelTick > WHEEL_SLOTS) wheelTick = nowTick - WHEEL_SLOTS; // one lap visits every bucket
+	while (wheelTick < nowTick) {
+		wheelTick++;
+		int slot = wheel[wheelTick % WHEEL_SLOTS];
+		while (slot >= 0) {
+			int next = wheelNext[slot];
+			if (wheelExpiry[slot] <= now) {
+				WheelRemove(slot);
+				long long deadline = stats->slotDeadline[slot];
+				if (deadline > 0 && deadline + DEADLINE_GRACE > now) {
+					WheelInsert(slot, deadline + DEADLINE_GRACE);
+				}
+				else if (deadline > 0 && childProcs[slot] != 0) {
+					//the child should have given up by itself; it is stuck outside the socket helpers
+					kill(childProcs[slot], SIGKILL);
+					stats->slotDeadline[slot] = 0;
+					__sync_fetch_and_add(&stats->deadlineKills, 1);
+				}
+			}
+			slot = next;
+		}
+	}
+}
+
+/*********************************************************************
+** Description: Binds and listens on a TCP port, returns the socket
+*********************************************************************/
+static int OpenListener(int portNumber) {
+	struct sockaddr_in serverAddress;
+
+	// Set up the address struct for this process (the server)
+	memset((char *)&serverAddress, '\0', sizeof(serverAddress)); // Clear out the address struct
+	serverAddress.sin_family = AF_INET; // Create a network-capable socket
+	serverAddress.sin_port = htons(portNumber); // Store the port number
+	serverAddress.sin_addr.s_addr = INADDR_ANY; // Any address is allowed for connection to this process
+
+	// Set up the socket
+	int listenSocketFD = socket(AF_INET, SOCK_STREAM, 0); // Create the socket
+	if (listenSocketFD < 0) error("SERVER: ERROR opening socket");
+
+	// Enable the socket to begin listening
+	if (bind(listenSocketFD, (struct sockaddr *)&serverAddress, sizeof(serverAddress)) < 0) // Connect socket to port
+		error("SERVER: ERROR on binding");
+
+	listen(listenSocketFD, 5); // Flip the socket on - it can now receive up to 5 connections
+	return listenSocketFD;
+}
+
+/*********************************************************************
+** Description: Listens on a unix socket at path for a successor that
+**		wants the listening socket, returns the socket
+*********************************************************************/
+static int OpenControl(const char* path) {
+	struct sockaddr_un controlAddress;
+	memset(&controlAddress, '\0', sizeof(controlAddress));
+	controlAddress.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(controlAddress.sun_path)) { fprintf(stderr, "SERVER: control path %s is too long\n", path); exit(1); }
+	strcpy(controlAddress.sun_path, path);
+
+	int controlSocketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (controlSocketFD < 0) error("SERVER: ERROR opening control socket");
+	unlink(path); // replaces a predecessor's control socket, which it no longer needs
+	if (bind(controlSocketFD, (struct sockaddr *)&controlAddress, sizeof(controlAddress)) < 0)
+		error("SERVER: ERROR binding control socket");
+	listen(controlSocketFD, 1);
+	return controlSocketFD;
+}
+
+/*********************************************************************
+** Description: Asks the daemon controlled at path for its listening
+**		socket and stores it in listenSocketFD; returns the control
+**		connection, on which the caller acknowledges once it is ready
+*********************************************************************/
+static int TakeOver(const char* path, int* listenSocketFD) {
+	struct sockaddr_un controlAddress;
+	memset(&controlAddress, '\0', sizeof(controlAddress));
+	controlAddress.sun_family = AF_UNIX;
+	strncpy(controlAddress.sun_path, path, sizeof(controlAddress.sun_path) - 1);
+
+	int predecessorFD = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (predecessorFD < 0) error("SERVER: ERROR opening control socket");
+	if (connect(predecessorFD, (struct sockaddr *)&controlAddress, sizeof(controlAddress)) < 0)
+		error("SERVER: ERROR connecting to running daemon");
+
+	// The socket arrives as ancillary data alongside a one byte message
+	char tag;
+	char control[CMSG_SPACE(sizeof(int))];
+	struct iovec data = { &tag, 1 };
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	if (recvmsg(predecessorFD, &message, 0) <= 0) error("SERVER: ERROR receiving listening socket");
+
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	if (header == NULL || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS) {
+		fprintf(stderr, "SERVER: running daemon did not pass a listening socket\n");
+		exit(1);
+	}
+	memcpy(listenSocketFD, CMSG_DATA(header), sizeof(int));
+	return predecessorFD;
+}
+
+/*********************************************************************
+** Description: Passes the listening socket to a successor connecting on
+**		the control socket, returns 1 once the successor confirms
+**		it is accepting
+*********************************************************************/
+static int HandOff(int controlSocketFD, int listenSocketFD) {
+	int successorFD = accept(controlSocketFD, NULL, NULL);
+	if (successorFD < 0) return 0;
+
+	char tag = 'L';
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+	struct iovec data = { &tag, 1 };
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(header), &listenSocketFD, sizeof(int));
+
+	//keep serving unless the successor confirms in time; finishing children mustn't interrupt the wait
+	sigset_t childSignal, previousMask;
+	sigemptyset(&childSignal);
+	sigaddset(&childSignal, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &childSignal, &previousMask);
+	char reply[3] = { 0 };
+	struct pollfd replyPoll = { successorFD, POLLIN, 0 };
+	int confirmed = sendmsg(successorFD, &message, 0) == 1
+		&& poll(&replyPoll, 1, HANDOFF_TIMEOUT * 1000) == 1
+		&& recv(successorFD, reply, 2, MSG_WAITALL) == 2
+		&& strcmp(reply, "ok") == 0;
+	sigprocmask(SIG_SETMASK, &previousMask, NULL);
+	close(successorFD);
+	if (!confirmed) fprintf(stderr, "SERVER: successor did not take over, still serving\n");
+	return confirmed;
+}
+
+/*********************************************************************
+** Description: Waits up to drainTimeout seconds for running children to
+**		finish, then kills any that are left
+*********************************************************************/
+static void Drain(struct DaemonMode* mode, int drainTimeout) {
+	time_t deadline = time(NULL) + drainTimeout;
+	ReapChildren();
+	Dispatch(mode, -1, -1, 1);
+	while ((numChildProcs > 0 || numPending > 0) && time(NULL) < deadline) {
+		poll(NULL, 0, WHEEL_TICK);
+		ReapChildren();
+		WheelAdvance(MonotonicMs());
+		Dispatch(mode, -1, -1, 1); // clients already accepted are still served
+	}
+	for (int i = 0; i < MAX_CHILDREN; i++) {
+		if (childProcs[i] == 0) continue;
+		kill(childProcs[i], SIGKILL);
+		waitpid(childProcs[i], NULL, 0);
+		PoolReleaseOwner(childProcs[i]);
+		childProcs[i] = 0;
+	}
+	numChildProcs = 0;
+	while (numPending > 0) DropPending(numPending - 1);
+}
+
+/*********************************************************************
+** Description: Collects finished children and frees their slots
+*********************************************************************/
+static void ReapChildren() {
+	for (int i = 0; i < MAX_CHILDREN; i++) {
+		if (childProcs[i] != 0 && waitpid(childProcs[i], NULL, WNOHANG) != 0) {
+			PoolReleaseOwner(childProcs[i]); // a killed child never returned its buffers
+			TenantAt(childTenants[i])->active--;
+			ReleaseMemory(i); // a killed child never returned its reservation
+			if (stats->slotTicket[i][0] != '\0') StoreAbandon(stats->slotTicket[i]); // nor its room in the result store
+			stats->slotTicket[i][0] = '\0';
+			childProcs[i] = 0;
+			numChildProcs--;
+			WheelRemove(i);
+			stats->slotDeadline[i] = 0;
+		}
+	}
+}
+
+/*********************************************************************
+** Description: SIGCHLD handler; only here so poll wakes up
+*********************************************************************/
+static void NoteChildExit(int signalNumber) {
+}
+
+/*********************************************************************
+** Description: SIGUSR1 handler; the main loop prints the counters
+*********************************************************************/
+static void NoteDumpRequest(int signalNumber) {
+	dumpRequested = 1;
+}
+
+/*********************************************************************
+** Description: Exchanges basic string messages with the client
+**		to determine that it has connected to the correct program
+*********************************************************************/
+int Handshake(struct DaemonMode* mode, int childSocket) {
+	// Get the message from the client
+	char buffer[1024];
+	memset(buffer, '\0', 1024);
+	int charsRead;
+
+	charsRead = RecvSome(childSocket, buffer, 1023); // Read the client's message from the socket
+	if (charsRead < 0) error("SERVER: ERROR reading from socket");//check  to make sure right # bytes were read
+
+	buffer[strcspn(buffer, " ")] = '\0'; // attributes such as tenant= follow the name
+	if (strcmp(buffer, mode->clientName) == 0) {
+		// Send a Success message back to the client
+		if (SendAll(childSocket, mode->progName, strlen(mode->progName)) != 1) error("SERVER: ERROR writing id message to socket");
+		return 1;
+	}
+	// Send a bogus message to tell client to kill itself
+	if (SendAll(childSocket, "no", 2) != 1) error("SERVER: ERROR writing id message to socket");
+	return 0;
+}
+
+/*********************************************************************
+** Description: Answers "fetch ticket=ID [wait=1]" with the stored
+**		result of an async job, "pending" or "unknown"; wait=1 holds
+**		the reply for up to half the idle timeout while the job runs
+*********************************************************************/
+static void FetchResult(int childSocket, const char* request) {
+	char ticket[OTP_TICKET_SIZE + 1], waitFlag[8], reply[64], ack[16];
+	if (GetAttribute(request, "ticket", ticket, sizeof(ticket)) != 1 || !ValidTicket(ticket)) {
+		SendAll(childSocket, "unknown", 7);
+		return;
+	}
+	int wait = GetAttribute(request, "wait", waitFlag, sizeof(waitFlag)) == 1 && strcmp(waitFlag, "1") == 0;
+	int resultFD = ClaimResult(ticket, wait ? idleTimeout / 2 : 0);
+	if (resultFD == OTP_RESULT_PENDING || resultFD == OTP_RESULT_UNKNOWN) {
+		if (resultFD == OTP_RESULT_PENDING) SendAll(childSocket, "pending", 7);
+		else SendAll(childSocket, "unknown", 7);
+		return;
+	}
+	if (resultFD < 0) error("SERVER: ERROR opening stored result");
+
+	//the result is only deleted once the client has all of it
+	struct stat info;
+	fstat(resultFD, &info);
+	sprintf(reply, "ready size=%lld", (long long)info.st_size);
+	memset(ack, '\0', sizeof(ack));
+	int delivered = SendAll(childSocket, reply, strlen(reply)) == 1 && RecvSome(childSocket, ack, sizeof(ack) - 1) > 0 && strcmp(ack, "sendResult") == 0;
+	char* chunk = PoolAlloc(FETCH_CHUNK);
+	if (chunk == NULL) error("SERVER: ERROR allocating fetch buffer");
+	long chunkLength;
+	while (delivered && (chunkLength = read(resultFD, chunk, FETCH_CHUNK)) > 0) {
+		delivered = SendAll(childSocket, chunk, chunkLength) == 1;
+	}
+	PoolFree(chunk);
+	ReleaseResult(ticket, resultFD, delivered);
+	if (delivered) __sync_fetch_and_add(&stats->jobs, 1);
+}
+
+/*********************************************************************
+** Description: Answers "stream chunk=N" by transforming frames until
+**		one of length 0: each is a length of FRAME_HEADER digits, up
+**		to N characters of text and as many of key, and is sent back
+**		transformed. Only one frame's buffers are reserved, however
+**		long the stream; newlines pass through but use up their key
+*********************************************************************/
+static void StreamMsg(struct DaemonMode* mode, int childSocket, const char* request, const struct OtpAlphabet* alphabet) {
+	char chunkValue[16], header[FRAME_HEADER + 1];
+	long long phaseStart = TraceNow();
+	size_t chunkSize = GetAttribute(request, "chunk", chunkValue, sizeof(chunkValue)) == 1 ? strtoul(chunkValue, NULL, 10) : 0;
+	long long footprint = 2 * (long long)chunkSize;
+	if (chunkSize == 0 || chunkSize > STREAM_MAX_CHUNK || footprint > memoryBudget) {
+		__sync_fetch_and_add(&stats->tooLarge, 1);
+		SendAll(childSocket, "toolarge", 8);
+		return;
+	}
+	if (ReserveMemory(footprint) != 1) {
+		char busy[32];
+		sprintf(busy, "busy retry=%d", BUDGET_RETRY_HINT);
+		__sync_fetch_and_add(&stats->busyReplies, 1);
+		SendAll(childSocket, busy, strlen(busy));
+		return;
+	}
+	char* text = PoolAlloc(chunkSize);
+	char* key = PoolAlloc(chunkSize);
+	if (text == NULL || key == NULL) error("SERVER: ERROR allocating stream buffers");
+	if (SendAll(childSocket, mode->textReq, strlen(mode->textReq)) != 1) error("SERVER: ERROR writing text request to socket");
+	TraceSpan("size exchange", phaseStart);
+
+	//a client that goes quiet between frames for longer than the idle timeout loses the stream
+	phaseStart = TraceNow();
+	while (1) {
+		long charsRead = RecvAll(childSocket, header, FRAME_HEADER);
+		if (charsRead < 0) error("SERVER: ERROR reading frame length from socket");
+		if (charsRead < FRAME_HEADER) { fprintf(stderr, "SERVER: client ended stream without a closing frame\n"); exit(1); }
+		header[FRAME_HEADER] = '\0';
+		if (strspn(header, "0123456789") != FRAME_HEADER) { fprintf(stderr, "SERVER: bad stream frame length\n"); exit(1); }
+		size_t length = strtoul(header, NULL, 10);
+		if (length == 0) break;
+		if (length > chunkSize) { fprintf(stderr, "SERVER: stream frame of %zu is over its chunk of %zu\n", length, chunkSize); exit(1); }
+		if (RecvAll(childSocket, text, length) != length) error("SERVER: ERROR reading stream text from socket");
+		if (RecvAll(childSocket, key, length) != length) error("SERVER: ERROR reading stream key from socket");
+		TenantAddBytes(currentTenant, length);
+
+		//transform each run of text between newlines with the key at the same position
+		for (size_t start = 0; start < length; ) {
+			char* newline = memchr(text + start, '\n', length - start);
+			size_t end = newline != NULL ? newline - text : length;
+			ParallelTransform(text + start, key + start, end - start, mode->transform, alphabet, numThreads, parallelThreshold);
+			start = end + 1;
+		}
+		if (SendAll(childSocket, text, length) != 1) error("SERVER: ERROR writing stream result to socket");
+	}
+	TraceSpan("stream", phaseStart);
+	__sync_fetch_and_add(&stats->jobs, 1);
+	PoolFree(text);
+	PoolFree(key);
+	ReleaseMemory(currentSlot);
+}
+
+/*********************************************************************
+** Description: Receives a text and key, transforms the text and sends
+**		the result back, or with async=1 hands out a ticket and stores
+**		the result for a later fetch
+*********************************************************************/
+void ProcessMsg(struct DaemonMode* mode, int childSocket) {
+	char buffer[1024];
+	memset(buffer, '\0', 1024);
+	char errMsg[100];
+	char* text;
+	size_t textSize;
+	char* key;
+	char* keyReq = "sendKey";
+	long charsRead;
+
+	//get text size from client, optionally followed by name=value attributes
+	long long phaseStart = TraceNow();
+	charsRead = RecvSome(childSocket, buffer, 1023); // Read the client's text size
+	if (charsRead < 0) error("SERVER: ERROR reading text size from socket");//check  to make sure right # bytes were read
+	if (charsRead == 0) return; // hung up after the handshake, as otp_lb's health probes do
+
+	const struct OtpAlphabet* alphabet = defaultAlphabet;
+	char alphabetName[64];
+	if (GetAttribute(buffer, "alphabet", alphabetName, sizeof(alphabetName)) == 1) {
+		alphabet = OtpCodecFindAlphabet(alphabetName);
+		if (alphabet == NULL) {
+			fprintf(stderr, "SERVER: client asked for unknown alphabet %s\n", alphabetName);
+			return;
+		}
+	}
+	char requestId[OTP_REQUEST_ID_SIZE];
+	if (GetAttribute(buffer, "rid", requestId, sizeof(requestId)) == 1) {
+		TraceSetRequestId(requestId);
+	}
+	if (strncmp(buffer, "fetch", 5) == 0) {
+		FetchResult(childSocket, buffer);
+		return;
+	}
+	if (strncmp(buffer, "stream", 6) == 0) {
+		StreamMsg(mode, childSocket, buffer, alphabet);
+		return;
+	}
+	char asyncFlag[8];
+	int async = GetAttribute(buffer, "async", asyncFlag, sizeof(asyncFlag)) == 1 && strcmp(asyncFlag, "1") == 0;
+
+	//the size must be plain digits; strtoul alone would take a sign or wrap a huge value
+	char* sizeEnd;
+	errno = 0;
+	unsigned long requested = strtoul(buffer, &sizeEnd, 10);
+	if (buffer[0] < '0' || buffer[0] > '9' || errno == ERANGE || (*sizeEnd != '\0' && *sizeEnd != ' ')) {
+		fprintf(stderr, "SERVER: client sent a malformed text size\n");
+		return;
+	}
+
+	//the text and key must fit in the memory budget before anything is allocated, compared before doubling so nothing overflows
+	if (requested >= (unsigned long long)memoryBudget / 2) {
+		__sync_fetch_and_add(&stats->tooLarge, 1);
+		SendAll(childSocket, "toolarge", 8);
+		return;
+	}
+	textSize = requested + 1;
+	long long footprint = 2 * (long long)textSize;
+	int admitted = ReserveMemory(footprint);
+	char ticket[OTP_TICKET_SIZE];
+	if (admitted == 1 && async) { // an async result also needs room in the store until it is fetched
+		NewTicket(ticket);
+		admitted = StoreBegin(ticket, textSize - 1);
+		if (admitted < 0) error("SERVER: ERROR opening result in store");
+		if (admitted == 1) strcpy(stats->slotTicket[currentSlot], ticket);
+		else ReleaseMemory(currentSlot);
+	}
+	if (admitted != 1) {
+		char busy[32];
+		sprintf(busy, "busy retry=%d", BUDGET_RETRY_HINT);
+		__sync_fetch_and_add(&stats->busyReplies, 1);
+		SendAll(childSocket, busy, strlen(busy));
+		return;
+	}
+	TenantAddBytes(currentTenant, textSize - 1);
+
+	//take text and key buffers for the incoming text size from the pool; only bytes not received get cleared
+	text = PoolAlloc(textSize);
+	key = PoolAlloc(textSize);
+	if (text == NULL || key == NULL) error("SERVER: ERROR allocating text and key");
+
+	//request text from client
+	if (SendAll(childSocket, mode->textReq, strlen(mode->textReq)) != 1) error("SERVER: ERROR writing text request to socket");
+	TraceSpan("size exchange", phaseStart);
+
+	//get text msg from client
+	phaseStart = TraceNow();
+	charsRead = RecvAll(childSocket, text, textSize - 1); // Read the client's text
+	sprintf(errMsg, "SERVER: ERROR reading %s from socket", mode->textName);
+	if (charsRead < 0) error(errMsg);//check  to make sure right # bytes were read
+	memset(text + charsRead, '\0', textSize - charsRead);
+	TraceSpan("receive text", phaseStart);
+
+	//request key from client
+	if (SendAll(childSocket, keyReq, strlen(keyReq)) != 1) error("SERVER: ERROR writing key request to socket");
+
+	//get key from client
+	phaseStart = TraceNow();
+	charsRead = RecvAll(childSocket, key, textSize - 1); // Read the client's key
+	if (charsRead < 0) error("SERVER: ERROR reading key from socket");//check  to make sure right # bytes were read
+	memset(key + charsRead, '\0', textSize - charsRead); // never leave an earlier job's key behind
+	TraceSpan("receive key", phaseStart);
+
+	//an async client takes its ticket and hangs up; the result waits in the store for a fetch
+	if (async) {
+		char reply[32];
+		sprintf(reply, "ticket=%s", ticket);
+		if (SendAll(childSocket, reply, strlen(reply)) != 1) error("SERVER: ERROR writing ticket to socket");
+		shutdown(childSocket, SHUT_RDWR);
+	}
+
+	//only the text before the newline is transformed
+	char* newline = memchr(text, '\n', textSize - 1);
+	size_t textLength = newline != NULL ? newline - text : strlen(text);
+	phaseStart = TraceNow();
+	ParallelTransform(text, key, textLength, mode->transform, alphabet, numThreads, parallelThreshold);
+	TraceSpan("transform", phaseStart);
+
+	//send transformed text back to client, or keep it for the ticket
+	phaseStart = TraceNow();
+	if (async) {
+		if (StoreResult(ticket, text, strlen(text)) != 1) error("SERVER: ERROR writing result to store");
+		stats->slotTicket[currentSlot][0] = '\0'; // the result is the store's to keep now
+		TraceSpan("store result", phaseStart);
+	}
+	else {
+		if (SendAll(childSocket, text, strlen(text)) != 1) error("SERVER: ERROR writing to socket");
+		TraceSpan("send result", phaseStart);
+	}
+	__sync_fetch_and_add(&stats->jobs, 1);
+	PoolFree(text);
+	PoolFree(key);
+	ReleaseMemory(currentSlot);
+}
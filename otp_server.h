@@ -0,0 +1,26 @@
+/*********************************************************************
+** Program: otp_server.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: The accept loop and request handling shared by
+**		otp_enc_d and otp_dec_d
+*********************************************************************/
+#ifndef OTP_SERVER_H
+#define OTP_SERVER_H
+
+#include <stddef.h>
+#include "otp_parallel.h"
+
+// What distinguishes one daemon from the other
+struct DaemonMode {
+	char* progName; // name sent back to a client that passes the handshake
+	char* clientName; // the only client name this daemon serves
+	char* textReq; // message asking the client for its text
+	char* textName; // what the client's text is called in error messages
+	char* action; // "encryption" or "decryption"
+	BlockTransform transform; // OtpCodecEncryptText or OtpCodecDecryptText
+};
+
+int RunDaemon(struct DaemonMode* mode, int argc, char *argv[]);
+
+#endif
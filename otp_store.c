@@ -0,0 +1,214 @@
+/*********************************************************************
+** Program: otp_store.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Holds the results of asynchronous jobs as files in a
+**		directory, by default in memory under /dev/shm, until their
+**		ticket is presented or they expire; the store is capped so
+**		unfetched results can't grow without bound
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/random.h>
+#include "otp_store.h"
+
+// A job's result moves through three names: ticket.part while it is
+// written, ticket once it is ready, ticket.taken while being fetched.
+// A part file is created at its full length, so the store's usage
+// counts running jobs as well as finished ones
+static char storeDir[256];
+static int resultTtl = OTP_DEFAULT_RESULT_TTL;
+static long long storeMax = OTP_DEFAULT_RESULT_STORE_MAX;
+
+/*********************************************************************
+** Description: Creates the store's directory if needed and refuses one
+**		that is not private to the daemon's user
+*********************************************************************/
+void StoreInit(const char* directory, int ttlSeconds, long long maxBytes) {
+	snprintf(storeDir, sizeof(storeDir), "%s", directory);
+	resultTtl = ttlSeconds;
+	storeMax = maxBytes;
+	if (mkdir(storeDir, 0700) == 0) chmod(storeDir, 0700); // whatever the umask
+	else if (errno != EEXIST) {
+		fprintf(stderr, "SERVER: could not create result store %s: %s\n", storeDir, strerror(errno));
+		exit(1);
+	}
+
+	//the default path is predictable, so a directory someone else made first must not be trusted with results
+	struct stat info;
+	if (lstat(storeDir, &info) != 0 || !S_ISDIR(info.st_mode) || info.st_uid != geteuid() || (info.st_mode & 0777) != 0700) {
+		fprintf(stderr, "SERVER: result store %s must be a directory owned by this user with mode 0700\n", storeDir);
+		exit(1);
+	}
+}
+
+/*********************************************************************
+** Description: Makes up an unguessable ticket of 16 hex digits
+*********************************************************************/
+void NewTicket(char* ticket) {
+	unsigned char random[8];
+	if (getrandom(random, sizeof(random), 0) != sizeof(random)) {
+		perror("SERVER: ERROR making ticket");
+		exit(1);
+	}
+	for (int i = 0; i < 8; i++) sprintf(ticket + 2 * i, "%02x", random[i]);
+}
+
+/*********************************************************************
+** Description: Returns 1 if ticket could have come from NewTicket, so
+**		it is safe to use in a path
+*********************************************************************/
+int ValidTicket(const char* ticket) {
+	return strlen(ticket) == OTP_TICKET_SIZE - 1 && strspn(ticket, "0123456789abcdef") == OTP_TICKET_SIZE - 1;
+}
+
+/*********************************************************************
+** Description: Returns the bytes held by every result in the store,
+**		including those of jobs still running
+*********************************************************************/
+long long StoreUsage() {
+	DIR* store = opendir(storeDir);
+	if (store == NULL) return 0;
+	long long usage = 0;
+	struct dirent* entry;
+	while ((entry = readdir(store)) != NULL) {
+		if (entry->d_name[0] == '.') continue;
+		char path[512];
+		struct stat info;
+		snprintf(path, sizeof(path), "%s/%s", storeDir, entry->d_name);
+		if (stat(path, &info) == 0 && S_ISREG(info.st_mode)) usage += info.st_size;
+	}
+	closedir(store);
+	return usage;
+}
+
+/*********************************************************************
+** Description: Claims room for a result of length bytes and marks the
+**		ticket's job as running, so a fetch waits for it rather than
+**		calling it unknown; returns 1 on success, 0 if the store is
+**		full and -1 on error
+*********************************************************************/
+int StoreBegin(const char* ticket, size_t length) {
+	char path[512];
+	sprintf(path, "%s/%s.part", storeDir, ticket);
+
+	//checking the room and taking it happen under one lock, so concurrent jobs can't overshoot
+	int dirFD = open(storeDir, O_RDONLY | O_DIRECTORY);
+	if (dirFD < 0) return -1;
+	flock(dirFD, LOCK_EX);
+	int result = -1;
+	if (StoreUsage() + (long long)length > storeMax) result = 0;
+	else {
+		int partFD = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+		if (partFD >= 0) {
+			if (ftruncate(partFD, length) == 0) result = 1;
+			else unlink(path);
+			close(partFD);
+		}
+	}
+	close(dirFD); // releases the lock
+	return result;
+}
+
+/*********************************************************************
+** Description: Gives back the room of a job that will never store its
+**		result
+*********************************************************************/
+void StoreAbandon(const char* ticket) {
+	char path[512];
+	sprintf(path, "%s/%s.part", storeDir, ticket);
+	unlink(path);
+}
+
+/*********************************************************************
+** Description: Writes the ticket's result and makes it fetchable in
+**		one rename; returns 1 on success
+*********************************************************************/
+int StoreResult(const char* ticket, const char* data, size_t length) {
+	char partPath[512], path[512];
+	sprintf(partPath, "%s/%s.part", storeDir, ticket);
+	sprintf(path, "%s/%s", storeDir, ticket);
+	int partFD = open(partPath, O_WRONLY); // keeps the length StoreBegin gave it until the data is in
+	if (partFD < 0) return 0;
+	size_t curChar = 0;
+	while (curChar < length) {
+		long charsWritten = write(partFD, data + curChar, length - curChar);
+		if (charsWritten < 0 && errno == EINTR) continue;
+		if (charsWritten <= 0) break;
+		curChar += charsWritten;
+	}
+	int truncated = ftruncate(partFD, length);
+	if (close(partFD) != 0 || truncated != 0 || curChar < length || rename(partPath, path) != 0) {
+		unlink(partPath);
+		return 0;
+	}
+	return 1;
+}
+
+/*********************************************************************
+** Description: Takes the ticket's result for one fetcher, waiting up to
+**		waitMs for a running job; returns an open file to read it
+**		from, OTP_RESULT_PENDING or OTP_RESULT_UNKNOWN
+*********************************************************************/
+int ClaimResult(const char* ticket, int waitMs) {
+	char partPath[512], path[512], takenPath[512];
+	sprintf(partPath, "%s/%s.part", storeDir, ticket);
+	sprintf(path, "%s/%s", storeDir, ticket);
+	sprintf(takenPath, "%s/%s.taken", storeDir, ticket);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long giveUp = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + waitMs;
+	while (1) {
+		//the rename succeeds for exactly one fetcher
+		if (rename(path, takenPath) == 0) return open(takenPath, O_RDONLY);
+		if (access(partPath, F_OK) != 0) {
+			if (rename(path, takenPath) == 0) return open(takenPath, O_RDONLY); // finished between the two checks
+			return OTP_RESULT_UNKNOWN;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec * 1000LL + now.tv_nsec / 1000000 >= giveUp) return OTP_RESULT_PENDING;
+		poll(NULL, 0, 20);
+	}
+}
+
+/*********************************************************************
+** Description: Deletes a claimed result once delivered, or puts it back
+**		for another try if the fetcher went away
+*********************************************************************/
+void ReleaseResult(const char* ticket, int resultFD, int delivered) {
+	char path[512], takenPath[512];
+	sprintf(path, "%s/%s", storeDir, ticket);
+	sprintf(takenPath, "%s/%s.taken", storeDir, ticket);
+	close(resultFD);
+	if (delivered) unlink(takenPath);
+	else rename(takenPath, path);
+}
+
+/*********************************************************************
+** Description: Deletes results nobody fetched within the TTL, and the
+**		leftovers of jobs that died
+*********************************************************************/
+void StoreSweep() {
+	DIR* store = opendir(storeDir);
+	if (store == NULL) return;
+	time_t oldest = time(NULL) - resultTtl;
+	struct dirent* entry;
+	while ((entry = readdir(store)) != NULL) {
+		if (entry->d_name[0] == '.') continue;
+		char path[512];
+		struct stat info;
+		snprintf(path, sizeof(path), "%s/%s", storeDir, entry->d_name);
+		if (stat(path, &info) == 0 && S_ISREG(info.st_mode) && info.st_mtime < oldest) unlink(path);
+	}
+	closedir(store);
+}
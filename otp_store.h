@@ -0,0 +1,32 @@
+/*********************************************************************
+** Program: otp_store.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Holds the results of asynchronous jobs as files in a
+**		directory, by default in memory under /dev/shm, until their
+**		ticket is presented or they expire; the store is capped so
+**		unfetched results can't grow without bound
+*********************************************************************/
+#ifndef OTP_STORE_H
+#define OTP_STORE_H
+
+#include <stddef.h>
+
+#define OTP_TICKET_SIZE 17 // 16 hex digits and a terminator
+#define OTP_DEFAULT_RESULT_TTL 3600 // seconds an unfetched result is kept
+#define OTP_DEFAULT_RESULT_STORE_MAX (256LL << 20) // bytes all stored and running results may take
+#define OTP_RESULT_UNKNOWN -1 // no job by that ticket, or its result was already taken
+#define OTP_RESULT_PENDING -2 // the job is still running
+
+void StoreInit(const char* directory, int ttlSeconds, long long maxBytes);
+void NewTicket(char* ticket);
+int ValidTicket(const char* ticket);
+int StoreResult(const char* ticket, const char* data, size_t length);
+int StoreBegin(const char* ticket, size_t length);
+void StoreAbandon(const char* ticket);
+long long StoreUsage();
+int ClaimResult(const char* ticket, int waitMs);
+void ReleaseResult(const char* ticket, int resultFD, int delivered);
+void StoreSweep();
+
+#endif
@@ -0,0 +1,181 @@
+/*********************************************************************
+** Program: otp_tenant.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Per-tenant usage, token buckets and weighted fair
+**		ordering of the connections a daemon has waiting
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "otp_tenant.h"
+#include "otp_net.h"
+
+static struct Tenant* tenants; // shared, so children can add the bytes they are asked for
+static int numTenants;
+static double jobRate; // jobs a second per unit of weight, 0 for no limit
+static double byteRate; // text bytes a second per unit of weight, 0 for no limit
+static double systemVirtual; // start tag of the job dispatched last
+static int sharedTenant; // entry named "*" that tenants past the table's size share
+static int AddTenant(const char* name, int index);
+
+/*********************************************************************
+** Description: Maps the tenant table, with no rate limits yet, and
+**		reserves the shared "*" entry so a full table still has one
+*********************************************************************/
+void TenantInit() {
+	tenants = mmap(NULL, OTP_MAX_TENANTS * sizeof(struct Tenant), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (tenants == MAP_FAILED) { perror("SERVER: ERROR mapping tenant table"); exit(1); }
+	sharedTenant = AddTenant("*", 0);
+	tenants[sharedTenant].pinned = 1;
+}
+
+/*********************************************************************
+** Description: Sets the rate limits of a tenant of weight 1; they
+**		scale with weight, and 0 means no limit
+*********************************************************************/
+void TenantSetRates(double jobsPerSecond, double bytesPerSecond) {
+	jobRate = jobsPerSecond;
+	byteRate = bytesPerSecond;
+}
+
+/*********************************************************************
+** Description: Applies a name=weight setting, returns 0 if it is
+**		malformed
+*********************************************************************/
+int TenantSetWeight(const char* spec) {
+	const char* equals = strrchr(spec, '=');
+	if (equals == NULL || equals == spec || equals - spec >= OTP_TENANT_NAME_SIZE) return 0;
+	double weight = atof(equals + 1);
+	if (weight <= 0) return 0;
+
+	char name[OTP_TENANT_NAME_SIZE];
+	memcpy(name, spec, equals - spec);
+	name[equals - spec] = '\0';
+	struct Tenant* tenant = TenantAt(FindTenant(name));
+	tenant->weight = weight;
+	tenant->pinned = 1;
+	return 1;
+}
+
+/*********************************************************************
+** Description: Returns the index of the named tenant, adding it with
+**		full buckets if it is new; once the table is full, a new name
+**		takes over the entry of the tenant idle the longest, or shares
+**		the "*" entry if none has been idle for OTP_TENANT_IDLE_MS
+*********************************************************************/
+int FindTenant(const char* name) {
+	long long now = MonotonicMs();
+	for (int i = 0; i < numTenants; i++) {
+		if (strcmp(tenants[i].name, name) == 0) {
+			tenants[i].lastUsed = now;
+			return i;
+		}
+	}
+	if (numTenants < OTP_MAX_TENANTS) return AddTenant(name, numTenants);
+
+	//an entry is only free once nothing refers to it and its byte debt is paid
+	int oldest = -1;
+	for (int i = 0; i < numTenants; i++) {
+		struct Tenant* tenant = &tenants[i];
+		if (tenant->pinned || tenant->active > 0 || tenant->queued > 0) continue;
+		if (now - tenant->lastUsed < OTP_TENANT_IDLE_MS || TenantReady(i, now) != 1) continue;
+		if (oldest < 0 || tenant->lastUsed < tenants[oldest].lastUsed) oldest = i;
+	}
+	if (oldest < 0) return sharedTenant;
+	memset(&tenants[oldest], '\0', sizeof(struct Tenant));
+	return AddTenant(name, oldest);
+}
+
+/*********************************************************************
+** Description: Puts a tenant of weight 1 in the table entry at index,
+**		which must be cleared, and returns index
+*********************************************************************/
+static int AddTenant(const char* name, int index) {
+	struct Tenant* tenant = &tenants[index];
+	snprintf(tenant->name, sizeof(tenant->name), "%s", name);
+	tenant->weight = 1;
+	tenant->virtualStart = systemVirtual;
+	tenant->jobTokens = -1; // filled on first refill
+	tenant->lastUsed = MonotonicMs();
+	if (index == numTenants) numTenants++;
+	return index;
+}
+
+/*********************************************************************
+** Description: Returns the tenant at index
+*********************************************************************/
+struct Tenant* TenantAt(int index) {
+	return &tenants[index];
+}
+
+/*********************************************************************
+** Description: Tops up the tenant's buckets and returns 1 if they allow
+**		it another job; a tenant whose jobs asked for more bytes
+**		than its bucket held waits until the debt is paid off
+*********************************************************************/
+int TenantReady(int index, long long now) {
+	struct Tenant* tenant = &tenants[index];
+	double jobCapacity = jobRate * tenant->weight > 1 ? jobRate * tenant->weight : 1; // a second's worth, at least one job
+	double byteCapacity = byteRate * tenant->weight;
+	if (tenant->jobTokens < 0) {
+		tenant->jobTokens = jobCapacity;
+		tenant->byteTokens = byteCapacity;
+		tenant->lastRefill = now;
+	}
+
+	double elapsed = (now - tenant->lastRefill) / 1000.0;
+	tenant->lastRefill = now;
+	tenant->jobTokens += elapsed * jobRate * tenant->weight;
+	if (tenant->jobTokens > jobCapacity) tenant->jobTokens = jobCapacity;
+	long long bytes = tenant->bytes;
+	tenant->byteTokens += elapsed * byteCapacity - (bytes - tenant->bytesCharged);
+	tenant->bytesCharged = bytes;
+	if (tenant->byteTokens > byteCapacity) tenant->byteTokens = byteCapacity;
+
+	if (jobRate > 0 && tenant->jobTokens < 1) return 0;
+	if (byteRate > 0 && tenant->byteTokens < 0) return 0;
+	return 1;
+}
+
+/*********************************************************************
+** Description: Returns the fair queuing start tag the tenant's next job
+**		would get; the waiting job with the lowest tag goes first
+*********************************************************************/
+double TenantStart(int index) {
+	return tenants[index].virtualStart > systemVirtual ? tenants[index].virtualStart : systemVirtual;
+}
+
+/*********************************************************************
+** Description: Charges the tenant for a job handed to a child, pushing
+**		its next job back in proportion to 1 / weight
+*********************************************************************/
+void TenantDispatched(int index) {
+	struct Tenant* tenant = &tenants[index];
+	systemVirtual = TenantStart(index);
+	tenant->virtualStart = systemVirtual + 1 / tenant->weight;
+	tenant->jobTokens -= 1;
+	tenant->jobs++;
+	tenant->queued--;
+	tenant->active++;
+}
+
+/*********************************************************************
+** Description: Called by a child once it knows its text size
+*********************************************************************/
+void TenantAddBytes(int index, size_t bytes) {
+	if (tenants == NULL || index < 0) return;
+	__sync_fetch_and_add(&tenants[index].bytes, (long long)bytes);
+}
+
+/*********************************************************************
+** Description: Prints each tenant's usage, one line per tenant
+*********************************************************************/
+void TenantDumpStats(FILE* out) {
+	for (int i = 0; i < numTenants; i++) {
+		struct Tenant* tenant = &tenants[i];
+		fprintf(out, "tenant %s weight %g active %d queued %d jobs %ld bytes %lld rejected %ld\n",
+			tenant->name, tenant->weight, tenant->active, tenant->queued, tenant->jobs, tenant->bytes, tenant->rejected);
+	}
+}
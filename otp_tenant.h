@@ -0,0 +1,48 @@
+/*********************************************************************
+** Program: otp_tenant.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Per-tenant usage, token buckets and weighted fair
+**		ordering of the connections a daemon has waiting
+*********************************************************************/
+#ifndef OTP_TENANT_H
+#define OTP_TENANT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define OTP_MAX_TENANTS 64 // tenants past this share one entry named "*"
+#define OTP_TENANT_IDLE_MS 300000 // ms without a connection before a tenant's entry can be reused
+#define OTP_TENANT_NAME_SIZE 48
+
+// One client, named by its handshake tenant= attribute or its address;
+// lives in memory shared with the children
+struct Tenant {
+	char name[OTP_TENANT_NAME_SIZE];
+	double weight; // share of the slots and of the rate limits, see --tenant-weight
+	double virtualStart; // fair queuing tag of the tenant's next job
+	double jobTokens;
+	double byteTokens;
+	long long bytesCharged; // bytes already taken out of byteTokens
+	long long lastRefill; // MonotonicMs the buckets were last topped up
+	int active; // children serving the tenant
+	int queued; // connections waiting for a slot
+	long jobs; // connections handed to a child
+	long long bytes; // text bytes requested, added by the children
+	long rejected; // connections closed because too many were waiting
+	long long lastUsed; // MonotonicMs of the tenant's last connection
+	int pinned; // set by --tenant-weight, never reused for another name
+};
+
+void TenantInit();
+void TenantSetRates(double jobRate, double byteRate);
+int TenantSetWeight(const char* spec);
+int FindTenant(const char* name);
+struct Tenant* TenantAt(int index);
+int TenantReady(int index, long long now);
+double TenantStart(int index);
+void TenantDispatched(int index);
+void TenantAddBytes(int index, size_t bytes);
+void TenantDumpStats(FILE* out);
+
+#endif
@@ -0,0 +1,131 @@
+/*********************************************************************
+** Program: otp_trace.c
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Opt-in timing of request phases, kept in a ring buffer
+**		and written out as Chrome trace JSON when the process exits
+*********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "otp_trace.h"
+
+// One timed phase; names are string literals so recording never copies
+struct TraceEvent {
+	const char* name;
+	long long start; // microseconds since the epoch, shared by every process on the host
+	long long duration;
+	int threadId;
+};
+
+static char* tracePath; // NULL while tracing is off
+static const char* traceProcessName;
+static char requestId[OTP_REQUEST_ID_SIZE];
+static struct TraceEvent ring[OTP_TRACE_CAPACITY];
+static volatile unsigned long numEvents; // total spans recorded, including overwritten ones
+
+/*********************************************************************
+** Description: Turns tracing on for this process and its children,
+**		with spans appended to the file at path on exit
+*********************************************************************/
+void TraceOpen(const char* path, const char* processName) {
+	tracePath = strdup(path);
+	traceProcessName = processName;
+	atexit(TraceDump);
+}
+
+/*********************************************************************
+** Description: Returns 1 if spans are being recorded
+*********************************************************************/
+int TraceEnabled() {
+	return tracePath != NULL;
+}
+
+/*********************************************************************
+** Description: Returns the time to start a span at, or 0 when tracing
+**		is off so untraced runs skip the clock read
+*********************************************************************/
+long long TraceNow() {
+	if (tracePath == NULL) return 0;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/*********************************************************************
+** Description: Records a span called name from start until now
+*********************************************************************/
+void TraceSpan(const char* name, long long start) {
+	if (tracePath == NULL) return;
+	unsigned long slot = __sync_fetch_and_add(&numEvents, 1) % OTP_TRACE_CAPACITY;
+	ring[slot].name = name;
+	ring[slot].start = start;
+	ring[slot].duration = TraceNow() - start;
+	ring[slot].threadId = syscall(SYS_gettid);
+}
+
+/*********************************************************************
+** Description: Tags this process's spans with the peer's request id;
+**		an id with anything but letters, digits, '_' and '-' is
+**		ignored, since it is written into the JSON unescaped
+*********************************************************************/
+void TraceSetRequestId(const char* id) {
+	if (id[0] == '\0' || id[strspn(id, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789_-")] != '\0') return;
+	snprintf(requestId, sizeof(requestId), "%s", id);
+}
+
+/*********************************************************************
+** Description: Returns the request id this process's spans carry,
+**		making one up from the pid and clock if no peer supplied it
+*********************************************************************/
+const char* TraceRequestId() {
+	if (requestId[0] == '\0') {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		snprintf(requestId, sizeof(requestId), "%08x%08x", (unsigned)getpid(), (unsigned)(now.tv_nsec ^ now.tv_sec));
+	}
+	return requestId;
+}
+
+/*********************************************************************
+** Description: Appends the recorded spans to the trace file in Chrome's
+**		JSON array format, which tolerates the missing closing
+**		bracket, so several processes can share one file
+*********************************************************************/
+void TraceDump() {
+	if (tracePath == NULL || numEvents == 0) return;
+	unsigned long last = numEvents;
+	unsigned long first = last > OTP_TRACE_CAPACITY ? last - OTP_TRACE_CAPACITY : 0;
+	int pid = getpid();
+
+	//build everything first so it reaches the file in one write
+	size_t outSize = (last - first + 1) * 256;
+	char* out = malloc(outSize);
+	if (out == NULL) return;
+	size_t length = snprintf(out, outSize, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n", pid, traceProcessName);
+	for (unsigned long i = first; i < last; i++) {
+		struct TraceEvent* event = &ring[i % OTP_TRACE_CAPACITY];
+		length += snprintf(out + length, outSize - length,
+			"{\"name\":\"%s\",\"cat\":\"otp\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{\"rid\":\"%s\"}},\n",
+			event->name, event->start, event->duration, pid, event->threadId, TraceRequestId());
+	}
+
+	int traceFD = open(tracePath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (traceFD < 0) { free(out); return; }
+	flock(traceFD, LOCK_EX);
+	struct stat traceInfo;
+	if (fstat(traceFD, &traceInfo) == 0 && traceInfo.st_size == 0) {
+		write(traceFD, "[\n", 2);
+	}
+	write(traceFD, out, length);
+	flock(traceFD, LOCK_UN);
+	close(traceFD);
+	free(out);
+	numEvents = 0;
+}
@@ -0,0 +1,24 @@
+/*********************************************************************
+** Program: otp_trace.h
+** Author: Phillip Wellheuser
+** Date: 12/6/19
+** Description: Opt-in timing of request phases, kept in a ring buffer
+**		and written out as Chrome trace JSON when the process exits
+*********************************************************************/
+#ifndef OTP_TRACE_H
+#define OTP_TRACE_H
+
+#include <stddef.h>
+
+#define OTP_TRACE_CAPACITY 1024 // spans kept per process, oldest overwritten first
+#define OTP_REQUEST_ID_SIZE 17 // 16 hex digits and a terminator
+
+void TraceOpen(const char* path, const char* processName);
+int TraceEnabled();
+long long TraceNow();
+void TraceSpan(const char* name, long long start);
+void TraceSetRequestId(const char* requestId);
+const char* TraceRequestId();
+void TraceDump();
+
+#endif